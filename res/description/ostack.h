@@ -6,6 +6,10 @@ enum
 	STACK_GROUP_STACK			= 10000,		// SEPARATOR
 	STACK_BASE_LENGTH			= 10001,		// REAL
 	STACK_BASE_PATH				= 10002,		// LINK
+	STACK_SHAPE						= 10003,		// LONG CYCLE
+		STACK_SHAPE_WALL			= 0,
+		STACK_SHAPE_SQUARE		= 1,
+		STACK_SHAPE_HEX				= 2,
 
 	STACK_GROUP_ITEMS			= 10010,		// SEPARATOR
 	STACK_BASE_COUNT			= 10011,		// LONG
@@ -13,12 +17,56 @@ enum
 	STACK_ROWS_HEIGHT			= 10013,		// REAL
 	STACK_CMD_FITHEIGHT		= 10014,		// COMMMAND BUTTON
 	STACK_RENDERINSTANCES	= 10015,		// BOOL
+	STACK_BASE_FITCOUNT		= 10016,		// BOOL
+	STACK_VARIATION_WEIGHTS	= 10017,	// STRING
+	STACK_CMD_EXPORT			= 10018,		// COMMAND BUTTON
 	
 	STACK_GROUP_RANDOM		= 10020,		// SEPARATOR
 	STACK_RANDOM_SEED			= 10021,		// LONG
 	STACK_RANDOM_ROT			= 10022,		// REAL
 	STACK_RANDOM_OFF_X		= 10023,		// REAL
-	STACK_RANDOM_OFF_Z		= 10024			// REAL
+	STACK_RANDOM_OFF_Z		= 10024,		// REAL
+	STACK_RANDOM_COLORS		= 10025,		// BOOL
+	STACK_RANDOM_COLOR_1	= 10026,		// COLOR
+	STACK_RANDOM_COLOR_2	= 10027,		// COLOR
+	STACK_SETTLE_ITERATIONS	= 10028,	// LONG
+	
+	STACK_GROUP_GRID			= 10040,		// SEPARATOR
+	STACK_GRID_COUNT_X		= 10041,		// LONG
+	STACK_GRID_COUNT_Z		= 10042,		// LONG
+	STACK_GRID_SPACING_X	= 10043,		// REAL
+	STACK_GRID_SPACING_Z	= 10044,		// REAL
+	
+	STACK_GROUP_GROWTH		= 10050,		// SEPARATOR
+	STACK_GROWTH_ENABLE		= 10051,		// BOOL
+	STACK_GROWTH_AMOUNT		= 10052,		// REAL
+	
+	STACK_GROUP_VIEWPORT	= 10030,		// SEPARATOR
+	STACK_LOD_MODE				= 10031,		// LONG CYCLE
+		STACK_LOD_MODE_OFF		= 0,
+		STACK_LOD_MODE_SHELL	= 1,
+		STACK_LOD_MODE_BOX		= 2,
+	STACK_LOD_THRESHOLD		= 10032,		// LONG
+	STACK_STORE_ITEMS			= 10033,		// BOOL
+	STACK_COMPACT_ITEMS		= 10034,		// BOOL
+	STACK_CULL_HIDDEN			= 10035,		// BOOL
+	STACK_SKIP_INVISIBLE	= 10036,		// BOOL
+	
+	STACK_GROUP_STATISTICS	= 10100,	// GROUP
+	STACK_STATS_ENABLE		= 10101,		// BOOL
+	STACK_STATS_PRINT			= 10102,		// BOOL
+	STACK_STATS_ITEMS			= 10103,		// LONG (read only)
+	STACK_STATS_CACHEHITS	= 10104,		// LONG (read only)
+	STACK_STATS_UPDATES		= 10105,		// LONG (read only)
+	STACK_STATS_REBUILDS	= 10106,		// LONG (read only)
+	STACK_STATS_TIME_INIT	= 10107,		// REAL (read only)
+	STACK_STATS_TIME_GENERATE	= 10108,	// REAL (read only)
+	STACK_STATS_TIME_BUILD	= 10109,		// REAL (read only)
+	STACK_CMD_PRINTSTATS	= 10110,		// COMMAND BUTTON
+	STACK_CMD_RESETSTATS	= 10111,		// COMMAND BUTTON
+	STACK_CMD_BENCHMARK		= 10112,		// COMMAND BUTTON
+	STACK_STATS_FINGERPRINT	= 10113,	// STRING (read only)
+	STACK_CMD_SELFTEST		= 10114		// COMMAND BUTTON
 	
 };
 
@@ -7,6 +7,7 @@ CONTAINER Ostack
 	{
 		DEFAULT 1;
 
+		LONG	STACK_SHAPE							{ ANIM OFF; CYCLE { STACK_SHAPE_WALL; STACK_SHAPE_SQUARE; STACK_SHAPE_HEX; } }
 		LINK	STACK_BASE_PATH					{ ACCEPT { Ospline; } }
 		REAL	STACK_BASE_LENGTH				{ UNIT METER; MIN 0.0; STEP 0.01; }
 
@@ -17,7 +18,7 @@ CONTAINER Ostack
 			COLUMNS 2;
 
 			LONG	STACK_BASE_COUNT				{ MIN 1; }
-			STATICTEXT										{ }
+			BOOL	STACK_BASE_FITCOUNT			{ }
 
 			LONG	STACK_ROWS_COUNT				{ MIN 1; }
 			STATICTEXT										{ }
@@ -26,14 +27,73 @@ CONTAINER Ostack
 			BUTTON	STACK_CMD_FITHEIGHT		{ }
 
 			BOOL	STACK_RENDERINSTANCES 	{ }
-			STATICTEXT										{ }
+			BUTTON	STACK_CMD_EXPORT			{ }
 		}
 
+		STRING	STACK_VARIATION_WEIGHTS	{ }
+
 		SEPARATOR	STACK_GROUP_RANDOM	{ }
 
 		LONG	STACK_RANDOM_SEED				{ MIN 0; }
 		REAL	STACK_RANDOM_ROT				{ UNIT DEGREE; STEP 0.01; }
 		REAL	STACK_RANDOM_OFF_X			{ UNIT METER; STEP 0.01; }
 		REAL	STACK_RANDOM_OFF_Z			{ UNIT METER; STEP 0.01; }
+		LONG	STACK_SETTLE_ITERATIONS	{ MIN 0; MAX 100; }
+		BOOL	STACK_RANDOM_COLORS			{ }
+		COLOR	STACK_RANDOM_COLOR_1		{ }
+		COLOR	STACK_RANDOM_COLOR_2		{ }
+
+		SEPARATOR	STACK_GROUP_GRID		{ }
+
+		GROUP
+		{
+			COLUMNS 2;
+
+			LONG	STACK_GRID_COUNT_X			{ MIN 1; }
+			REAL	STACK_GRID_SPACING_X		{ UNIT METER; STEP 0.01; }
+
+			LONG	STACK_GRID_COUNT_Z			{ MIN 1; }
+			REAL	STACK_GRID_SPACING_Z		{ UNIT METER; STEP 0.01; }
+		}
+
+		SEPARATOR	STACK_GROUP_GROWTH	{ }
+
+		BOOL	STACK_GROWTH_ENABLE			{ }
+		REAL	STACK_GROWTH_AMOUNT			{ UNIT PERCENT; MIN 0.0; MAX 100.0; CUSTOMGUI REALSLIDER; }
+
+		SEPARATOR	STACK_GROUP_VIEWPORT	{ }
+
+		LONG	STACK_LOD_MODE					{ ANIM OFF; CYCLE { STACK_LOD_MODE_OFF; STACK_LOD_MODE_SHELL; STACK_LOD_MODE_BOX; } }
+		LONG	STACK_LOD_THRESHOLD			{ ANIM OFF; MIN 0; }
+		BOOL	STACK_CULL_HIDDEN				{ }
+		BOOL	STACK_SKIP_INVISIBLE		{ ANIM OFF; }
+		BOOL	STACK_STORE_ITEMS				{ ANIM OFF; }
+		BOOL	STACK_COMPACT_ITEMS			{ ANIM OFF; }
+	}
+
+	GROUP STACK_GROUP_STATISTICS
+	{
+		BOOL	STACK_STATS_ENABLE			{ ANIM OFF; }
+		BOOL	STACK_STATS_PRINT				{ ANIM OFF; }
+
+		SEPARATOR										{ LINE; }
+
+		LONG	STACK_STATS_ITEMS				{ ANIM OFF; }
+		LONG	STACK_STATS_CACHEHITS		{ ANIM OFF; }
+		LONG	STACK_STATS_UPDATES			{ ANIM OFF; }
+		LONG	STACK_STATS_REBUILDS		{ ANIM OFF; }
+		REAL	STACK_STATS_TIME_INIT		{ ANIM OFF; STEP 0.001; }
+		REAL	STACK_STATS_TIME_GENERATE	{ ANIM OFF; STEP 0.001; }
+		REAL	STACK_STATS_TIME_BUILD	{ ANIM OFF; STEP 0.001; }
+		STRING	STACK_STATS_FINGERPRINT	{ ANIM OFF; }
+
+		GROUP
+		{
+			COLUMNS 4;
+			BUTTON	STACK_CMD_PRINTSTATS	{ }
+			BUTTON	STACK_CMD_RESETSTATS	{ }
+			BUTTON	STACK_CMD_BENCHMARK		{ }
+			BUTTON	STACK_CMD_SELFTEST		{ }
+		}
 	}
 }
@@ -0,0 +1,287 @@
+#include "canstackbenchmark.h"
+#include "canstackgenerator.h"
+
+
+/// Base counts the benchmark sweeps over
+static const Int32 g_benchmarkBaseCounts[] = { 10, 30, 100, 300, 1000, 3000, 10000 };
+
+/// Maximum number of rows per pass. Full pyramids would have GaussSum(baseCount) items, which is 50 million for the largest pass.
+static const Int32 CANSTACK_BENCHMARK_MAX_ROWS = 100;
+
+/// Passes with more items than this only measure generation, not geometry building
+static const Int CANSTACK_BENCHMARK_MAX_BUILD_ITEMS = 250000;
+
+/// Numbers of render instances the instance creation passes create
+static const Int g_benchmarkInstanceCounts[] = { 1000, 10000, 100000 };
+
+
+/// Results of a single benchmark pass
+struct StackBenchmarkResult
+{
+	Int			_itemCount;				///< Number of generated items
+	Float		_timeInit;				///< Duration of InitStack() in milliseconds
+	Float		_timeGenerate;		///< Duration of GenerateStack() in milliseconds
+	Float		_timeBuild;				///< Duration of BuildStackGeometry() in milliseconds
+	Int64		_memoryUsed;			///< Memory allocated by the pass (stack data and geometry) in bytes
+	Bool		_built;						///< True if BuildStackGeometry() has been measured
+
+	// Default constructor
+	StackBenchmarkResult() : _itemCount(0), _timeInit(0.0), _timeGenerate(0.0), _timeBuild(0.0), _memoryUsed(0), _built(false)
+	{ }
+};
+
+
+/// Returns the amount of memory currently allocated by Cinema 4D, in bytes
+static Int64 GetMemoryInUse()
+{
+	BaseContainer stat;
+	GeGetMemoryStat(stat);
+	return stat.GetInt64(C4D_MEMORY_STAT_MEMORY_INUSE);
+}
+
+
+/// Returns the peak amount of memory allocated by Cinema 4D, in bytes
+static Int64 GetMemoryPeak()
+{
+	BaseContainer stat;
+	GeGetMemoryStat(stat);
+	return stat.GetInt64(C4D_MEMORY_STAT_MEMORY_PEAK);
+}
+
+
+/// Returns the number of items processed per second
+static Float ItemsPerSecond(Int itemCount, Float milliSeconds)
+{
+	return (Float)itemCount * 1000.0 / Max(milliSeconds, 0.001);
+}
+
+
+/// Creates a temporary zigzag spline to be used as path if the user didn't link one
+static SplineObject *CreateBenchmarkPath()
+{
+	const Int32 pointCount = 8;
+	SplineObject *spline = SplineObject::Alloc(pointCount, SPLINETYPE_LINEAR);
+	if (!spline)
+		return nullptr;
+
+	Vector *points = spline->GetPointW();
+	for (Int32 i = 0; i < pointCount; ++i)
+	{
+		points[i] = Vector((i % 2) * 200.0, 0.0, i * 500.0);
+	}
+	spline->Message(MSG_UPDATE);
+
+	return spline;
+}
+
+
+/// Runs one benchmark pass with a fresh generator
+static Bool RunBenchmarkPass(BaseObject *sourceObject, SplineObject *path, Int32 baseCount, Bool useRenderInstances, StackBenchmarkResult &result)
+{
+	// Typical parameters, with random values so that all code paths are used
+	StackParameters params;
+	params._baseCount = baseCount;
+	params._baseLength = 10.0 * baseCount;
+	params._rowCount = Min(baseCount, CANSTACK_BENCHMARK_MAX_ROWS);
+	params._rowHeight = 10.0;
+	params._randomSeed = 12345;
+	params._randomRot = DegToRad(10.0);
+	params._randomOffX = 1.0;
+	params._randomOffZ = 1.0;
+	params._basePath = path;
+	params._renderInstances = useRenderInstances;
+
+	Int64 memoryStart = GetMemoryInUse();
+
+	// Initialize stack
+	CanStackGenerator generator;
+	Float64 timeStart = GeGetMilliSeconds();
+	if (!generator.InitStack(params))
+		return false;
+	Float64 timeInit = GeGetMilliSeconds();
+
+	// Generate stack
+	if (!generator.GenerateStack())
+		return false;
+	Float64 timeGenerate = GeGetMilliSeconds();
+
+	result._itemCount = generator.GetItemCount();
+	result._timeInit = timeInit - timeStart;
+	result._timeGenerate = timeGenerate - timeInit;
+
+	// Build geometry, if it's not too much
+	if (sourceObject && result._itemCount <= CANSTACK_BENCHMARK_MAX_BUILD_ITEMS)
+	{
+		AutoFree<BaseObject> geometry;
+		geometry.Set(generator.BuildStackGeometry(sourceObject, Matrix(), StackBuildSettings(useRenderInstances, STACK_LOD_MODE_OFF)));
+		if (!geometry)
+			return false;
+
+		result._timeBuild = GeGetMilliSeconds() - timeGenerate;
+		result._built = true;
+	}
+
+	// Geometry (if any) is still allocated here, so this includes it
+	result._memoryUsed = GetMemoryInUse() - memoryStart;
+
+	return true;
+}
+
+
+/// Creates render instances of an object in the two ways BuildStackGeometry() could: Allocating and setting up every instance,
+/// or copying one instance that has been set up before. Both are timed, the instances are freed after measuring.
+static Bool RunInstanceBenchmarkPass(BaseObject *sourceObject, Int instanceCount, Float &timeAlloc, Float &timeCopy)
+{
+	maxon::BaseArray<BaseObject*> instances;
+	if (!instances.Resize(instanceCount))
+		return false;
+	for (Int instanceIndex = 0; instanceIndex < instanceCount; ++instanceIndex)
+		instances[instanceIndex] = nullptr;
+
+	Bool result = true;
+	for (Int32 copyTemplate = 0; copyTemplate < 2 && result; ++copyTemplate)
+	{
+		AutoFree<BaseObject> instanceTemplate;
+		Float64 timeStart = GeGetMilliSeconds();
+
+		for (Int instanceIndex = 0; instanceIndex < instanceCount; ++instanceIndex)
+		{
+			BaseObject *newInstance = nullptr;
+			if (copyTemplate)
+			{
+				// Set up template once, then copy it
+				if (!instanceTemplate)
+				{
+					instanceTemplate.Set(BaseObject::Alloc(Oinstance));
+					if (!instanceTemplate)
+					{
+						result = false;
+						break;
+					}
+					instanceTemplate->GetDataInstance()->SetLink(INSTANCEOBJECT_LINK, sourceObject);
+					instanceTemplate->GetDataInstance()->SetBool(INSTANCEOBJECT_RENDERINSTANCE, true);
+				}
+				newInstance = static_cast<BaseObject*>(instanceTemplate->GetClone(COPYFLAGS_0, nullptr));
+			}
+			else
+			{
+				// Allocate and set up every instance
+				newInstance = BaseObject::Alloc(Oinstance);
+				if (newInstance)
+				{
+					BaseContainer *newInstanceData = newInstance->GetDataInstance();
+					newInstanceData->SetLink(INSTANCEOBJECT_LINK, sourceObject);
+					newInstanceData->SetBool(INSTANCEOBJECT_RENDERINSTANCE, true);
+				}
+			}
+			if (!newInstance)
+			{
+				result = false;
+				break;
+			}
+			instances[instanceIndex] = newInstance;
+		}
+
+		Float time = GeGetMilliSeconds() - timeStart;
+		if (copyTemplate)
+			timeCopy = time;
+		else
+			timeAlloc = time;
+
+		// Free instances, not measured
+		for (Int instanceIndex = 0; instanceIndex < instanceCount; ++instanceIndex)
+			BaseObject::Free(instances[instanceIndex]);
+	}
+
+	return result;
+}
+
+
+Bool RunStackBenchmark(BaseObject *sourceObject, SplineObject *path)
+{
+	// Use temporary path if none given
+	AutoFree<SplineObject> tempPath;
+	if (!path)
+	{
+		tempPath.Set(CreateBenchmarkPath());
+		if (!tempPath)
+			return false;
+		path = tempPath;
+	}
+
+	GePrint("CanStack benchmark: baseCount, rows, items, path, instances, init ms, generate ms, generated items/s, build ms, built items/s, memory MB");
+
+	Bool result = true;
+	const Int passCount = sizeof(g_benchmarkBaseCounts) / sizeof(g_benchmarkBaseCounts[0]);
+	for (Int passIndex = 0; passIndex < passCount; ++passIndex)
+	{
+		Int32 baseCount = g_benchmarkBaseCounts[passIndex];
+
+		StatusSetText("CanStack benchmark: baseCount " + String::IntToString(baseCount));
+		StatusSetBar((Int32)(100 * passIndex / passCount));
+
+		// Without and with path spline
+		for (Int32 usePath = 0; usePath < 2; ++usePath)
+		{
+			// Without and with render instances
+			for (Int32 useRenderInstances = 0; useRenderInstances < 2; ++useRenderInstances)
+			{
+				StackBenchmarkResult passResult;
+				if (!RunBenchmarkPass(sourceObject, usePath ? path : nullptr, baseCount, useRenderInstances != 0, passResult))
+				{
+					GePrint("CanStack benchmark: pass failed for baseCount " + String::IntToString(baseCount));
+					result = false;
+					continue;
+				}
+
+				String line = String::IntToString(baseCount) + ", " +
+				              String::IntToString(Min(baseCount, CANSTACK_BENCHMARK_MAX_ROWS)) + ", " +
+				              String::IntToString(passResult._itemCount) + ", " +
+				              (usePath ? "yes, " : "no, ") +
+				              (useRenderInstances ? "yes, " : "no, ") +
+				              String::FloatToString(passResult._timeInit) + ", " +
+				              String::FloatToString(passResult._timeGenerate) + ", " +
+				              String::FloatToString(ItemsPerSecond(passResult._itemCount, passResult._timeGenerate), -1, 0) + ", ";
+				if (passResult._built)
+					line += String::FloatToString(passResult._timeBuild) + ", " + String::FloatToString(ItemsPerSecond(passResult._itemCount, passResult._timeBuild), -1, 0) + ", ";
+				else
+					line += "skipped, skipped, ";
+				line += String::FloatToString((Float)passResult._memoryUsed / (1024.0 * 1024.0));
+
+				GePrint(line);
+			}
+		}
+	}
+
+	// Render instance creation, the largest part of building geometry with render instances
+	if (sourceObject)
+	{
+		GePrint("CanStack benchmark: instances, alloc ms, alloc instances/s, template copy ms, template copy instances/s");
+
+		const Int instancePassCount = sizeof(g_benchmarkInstanceCounts) / sizeof(g_benchmarkInstanceCounts[0]);
+		for (Int passIndex = 0; passIndex < instancePassCount; ++passIndex)
+		{
+			Int instanceCount = g_benchmarkInstanceCounts[passIndex];
+			Float timeAlloc = 0.0;
+			Float timeCopy = 0.0;
+			if (!RunInstanceBenchmarkPass(sourceObject, instanceCount, timeAlloc, timeCopy))
+			{
+				GePrint("CanStack benchmark: instance pass failed for " + String::IntToString(instanceCount) + " instances");
+				result = false;
+				continue;
+			}
+
+			GePrint(String::IntToString(instanceCount) + ", " +
+			        String::FloatToString(timeAlloc) + ", " +
+			        String::FloatToString(ItemsPerSecond(instanceCount, timeAlloc), -1, 0) + ", " +
+			        String::FloatToString(timeCopy) + ", " +
+			        String::FloatToString(ItemsPerSecond(instanceCount, timeCopy), -1, 0));
+		}
+	}
+
+	GePrint("CanStack benchmark: peak memory " + String::FloatToString((Float)GetMemoryPeak() / (1024.0 * 1024.0)) + " MB");
+
+	StatusClear();
+
+	return result;
+}
@@ -0,0 +1,18 @@
+#ifndef CANSTACKBENCHMARK_H__
+#define CANSTACKBENCHMARK_H__
+
+
+#include "c4d.h"
+
+
+/// Runs the CanStackGenerator benchmark and prints the results to the console.
+/// Sweeps baseCounts from 10 to 10000, each with and without a path spline, and with and without render instances.
+/// For each pass, InitStack(), GenerateStack() and BuildStackGeometry() are timed, and items per second and memory usage are reported.
+/// Finally, creating render instances by allocating each one is compared to copying a prepared instance.
+/// @param[in] sourceObject				The object to stack. If nullptr, geometry building is skipped and only generation is measured.
+/// @param[in] path								The path spline to use for spline passes. If nullptr, a temporary spline is created.
+/// @return												True if all passes succeeded, otherwise false
+Bool RunStackBenchmark(BaseObject *sourceObject, SplineObject *path);
+
+
+#endif // CANSTACKBENCHMARK_H__
@@ -1,41 +1,251 @@
 #include "canstackgenerator.h"
+#include "parallelhelpers.h"
+#include "objecthelpers.h"
+#include "stackrandom.h"
 
 
-Bool CanStackGenerator::InitStack(const StackParameters &params)
+/// Minimum number of items that justifies generating on an extra thread
+static const Int CANSTACK_MIN_ITEMS_PER_THREAD = 1024;
+
+
+/// Minimum number of segments for sampling the path spline
+static const Int CANSTACK_MIN_SPLINE_SEGMENTS = 256;
+
+
+/// Maximum number of items in the base row when it is fitted to the item size
+static const Int32 CANSTACK_MAX_FIT_COUNT = 10000;
+
+
+/// Maximum number of settle iterations
+static const Int32 CANSTACK_MAX_SETTLE_ITERATIONS = 100;
+
+
+/// Number of items the straight stack kernel processes per block
+static const Int CANSTACK_KERNEL_BLOCK_SIZE = 256;
+
+
+/// Random streams for the item attributes. They are drawn with a different seed than the layout streams (see CANSTACK_ATTRIBUTE_SEED_SALT),
+/// so adding attributes doesn't change any existing layout.
+enum STACKATTRIBUTE
+{
+	STACKATTRIBUTE_VARIATION	= 0,		///< Variation index
+	STACKATTRIBUTE_VALUE			= 1			///< Random value
+};
+
+
+/// Mixed into the random seed for the attribute streams
+static const UInt32 CANSTACK_ATTRIBUTE_SEED_SALT = 0x5A17AB1E;
+
+
+/// Fills a compact item. The values are rounded to 32 bit floats once, so the same inputs always give the same bits
+/// @param[out] item							The compact item
+/// @param[in] position						Position of the item, relative to the generator or the path spline
+/// @param[in] heading						Rotation of the item around its Y axis
+static inline void SetCompactItem(CompactStackItem &item, const Vector &position, Float heading)
+{
+	item.posX = (Float32)position.x;
+	item.posY = (Float32)position.y;
+	item.posZ = (Float32)position.z;
+	item.heading = (Float32)heading;
+}
+
+
+/// Adds data to a 64 bit FNV-1a hash
+static void HashBytes(UInt64 &hash, const void *data, Int size)
+{
+	const UChar *bytes = static_cast<const UChar*>(data);
+	for (Int i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+
+/// Adds a value to a 64 bit FNV-1a hash
+template <typename T> static void HashValue(UInt64 &hash, const T &value)
+{
+	HashBytes(hash, &value, sizeof(T));
+}
+
+
+UInt64 StackParameters::GetLayoutFingerprint() const
+{
+	// FNV offset basis
+	UInt64 hash = 14695981039346656037ULL;
+	
+	// Parameters
+	HashValue(hash, _shape);
+	HashValue(hash, _baseCount);
+	HashValue(hash, _baseLength);
+	HashValue(hash, _rowCount);
+	HashValue(hash, _rowHeight);
+	HashValue(hash, _randomSeed);
+	HashValue(hash, _randomRot);
+	HashValue(hash, _randomOffX);
+	HashValue(hash, _randomOffZ);
+	HashValue(hash, _settleIterations);
+	if (_settleIterations > 0)
+		HashValue(hash, _itemRadius);
+	HashValue(hash, _compactItems);
+	HashValue(hash, _gridCountX);
+	HashValue(hash, _gridCountZ);
+	HashValue(hash, _gridSpacingX);
+	HashValue(hash, _gridSpacingZ);
+	
+	// The spline pointer itself is not hashed, as it's meaningless outside of this session, but its placement is
+	Bool hasBasePath = _basePath != nullptr;
+	HashValue(hash, hasBasePath);
+	HashValue(hash, _basePathMg);
+	
+	return hash;
+}
+
+
+UInt64 StackParameters::GetFingerprint() const
 {
-	// Init random number generator (we have to do this always to ensure reproducible random results!)
-	_random.Init(params._randomSeed);
+	UInt64 hash = GetLayoutFingerprint();
+	
+	// Parameters that don't move items
+	HashValue(hash, _renderInstances);
+	HashValue(hash, _variationCount);
+	
+	// Weights only decide between variations, like in Compare(). With a single variation, changing them doesn't change the stack.
+	if (_variationCount > 1)
+	{
+		for (Int32 variationIndex = 0; variationIndex < Min(_variationCount, CANSTACK_MAX_VARIATIONS); ++variationIndex)
+			HashValue(hash, _variationWeights[variationIndex]);
+	}
+	
+	// State of the inputs
+	HashValue(hash, _basePathDirty);
+	HashValue(hash, _sourceDirty);
+	
+	return hash;
+}
 
-	// If new params are the same as the previous ones, don't do anything else
-	if (params == _params)
+
+void StackParameters::ParseVariationWeights(const String &text, Float *weights)
+{
+	Int32 variationIndex = 0;
+	Int start = 0;
+	Int length = text.GetLength();
+	
+	// Split text at separators, and read one number from each part
+	for (Int position = 0; position <= length && variationIndex < CANSTACK_MAX_VARIATIONS; ++position)
+	{
+		Bool isSeparator = (position == length) || (text[position] == ' ') || (text[position] == ',') || (text[position] == ';') || (text[position] == '\t');
+		if (!isSeparator)
+			continue;
+		
+		if (position > start)
+		{
+			Bool error = false;
+			Float weight = text.SubStr(start, position - start).ParseToFloat(&error);
+			weights[variationIndex++] = error ? 1.0 : Max(weight, 0.0);
+		}
+		start = position + 1;
+	}
+	
+	// Default weight for all others
+	for (; variationIndex < CANSTACK_MAX_VARIATIONS; ++variationIndex)
+		weights[variationIndex] = 1.0;
+}
+
+
+Bool CanStackGenerator::InitStack(const StackParameters &params)
+{
+	// Remember what kind of change this is, so the caller can decide if existing geometry can be updated
+	_lastChanges = _initialized ? params.Compare(_params) : STACKCHANGE_STRUCTURE;
+	
+	// If new params and inputs are the same as the previous ones, don't do anything else
+	UInt64 fingerprint = params.GetFingerprint();
+	if (_initialized && fingerprint == _fingerprint && params._basePath == _params._basePath)
+		return true;
+	
+	// Only the stacked object changed, the generated items are still valid
+	if (_initialized && _lastChanges == STACKCHANGE_SOURCE)
+	{
+		_params = params;
+		_fingerprint = fingerprint;
 		return true;
+	}
+	
+	// Items read from a file are still valid if they have been generated with the same layout
+	if (_restored)
+	{
+		_restored = false;
+		Int restoredCount = params._compactItems ? _compactItems.GetCount() : _items.GetCount();
+		if (!_initialized && params.GetLayoutFingerprint() == _restoredFingerprint && CalculateItemCount(params) == restoredCount)
+		{
+			_params = params;
+			if (!ResizeStack())
+				return false;
+			
+			// Attributes are not stored, they are cheap to generate again
+			if (!GenerateAttributes())
+				return false;
+			
+			_fingerprint = fingerprint;
+			_generated = true;
+			_initialized = true;
+			return true;
+		}
+	}
 	
 	// Default member values
 	_params = StackParameters();
 	_initialized = false;
+	_generated = false;
 	
-	// Cancel if nonsense baseCount
-	if (params._baseCount < 1)
+	// Cancel if nonsense baseCount or grid size
+	if (params._baseCount < 1 || params._gridCountX < 1 || params._gridCountZ < 1)
 		return false;
 	
 	// Store parameters internally
 	_params = params;
 	
-	// Make sure the stack array and its row arrays are of correct size
-	if (!ResizeStack(_params._baseCount, _params._rowCount))
+	// Make sure the stack array is of correct size
+	if (!ResizeStack())
 		return false;
 	
 	// Success, we made it!
+	_fingerprint = fingerprint;
 	_initialized = true;
 	return _initialized;
 }
 
 
+Bool CanStackGenerator::FitBaseCount(StackParameters &params, Float itemSize)
+{
+	// Keep the count for items without size
+	if (itemSize <= 0.0)
+		return true;
+	
+	// Length of the base row
+	Float length = params._baseLength;
+	if (params._basePath && !_splineSamples.GetLength(params._basePath, length))
+		return false;
+	
+	// On a straight stack, each item gets an equal share of the length. On a spline, the outer items sit on the ends of the spline.
+	Float fittingCount = Floor(length / itemSize);
+	if (params._basePath)
+		fittingCount += 1.0;
+	
+	params._baseCount = (Int32)ClampValue(fittingCount, 1.0, (Float)CANSTACK_MAX_FIT_COUNT);
+	return true;
+}
+
+
 Bool CanStackGenerator::GenerateStack()
 {
 	if (!_initialized)
 		return false;
 	
+	// Nothing to do if the items have already been generated for these parameters
+	if (_generated)
+		return true;
+	
 	// Some values
 	Float distance(0.0);			// Distance between items in a normal row
 	Float relDistance(0.0);		// Relative distance between items in a row on a path spline
@@ -44,67 +254,404 @@ Bool CanStackGenerator::GenerateStack()
 	// If spline is used, use length of spline as baseLength
 	if (_params._basePath)
 	{
-		splineMg = _params._basePath->GetMg();
+		splineMg = _params._basePathMg;
 		
-		// Allocate SplineLengthData
-		if (!_splineLengthData)
-		{
-			_splineLengthData.Set(SplineLengthData::Alloc());
-			if (!_splineLengthData)
-				return false;
-		}
+		// Calculate relative distance between clones on spline
+		if (_params._baseCount > 1)
+			relDistance = 1.0 / (Float)(_params._baseCount - 1);
 		
-		// Initialize SplineLengthData
-		if (!_splineLengthData->Init(_params._basePath))
-			return false;
+		// All items sit on multiples of half the relative distance. Choose a segment count that hits those offsets exactly.
+		Int segmentCount = Max((Int)2 * (_params._baseCount - 1), (Int)1);
+		while (segmentCount < CANSTACK_MIN_SPLINE_SEGMENTS)
+			segmentCount *= 2;
 		
-		// Calculate relative distance between clones on spline
-		relDistance = 1.0 / (Float)(_params._baseCount - 1);
+		// Sample spline (only does something if the spline has changed)
+		if (!_splineSamples.Update(_params._basePath, segmentCount))
+			return false;
 	}
 	else
 	{
 		// Create distance between clones
 		distance = _params._baseLength / (Float)_params._baseCount;
 	}
+	
+	// Each item draws its random values only from its own index, so the item ranges can be generated on any number of threads
+	auto generateRange = [this, distance, relDistance, &splineMg](Int start, Int end) -> Bool
+	{
+		return GenerateItems(start, end, distance, relDistance, splineMg);
+	};
+	
+	_generated = ParallelForRanges(GetItemCount(), CANSTACK_MIN_ITEMS_PER_THREAD, generateRange) && SettleItems() && GenerateAttributes();
+	return _generated;
+}
 
-	// Iterate stack rows
-	Int32 rowIndex = 0;
-	for (StackRowArray::Iterator row = _array.Begin(); row != _array.End(); ++row, rowIndex++)
+
+Bool CanStackGenerator::SettleItems()
+{
+	Int itemCount = GetItemCount();
+	Int32 iterationCount = Min(_params._settleIterations, CANSTACK_MAX_SETTLE_ITERATIONS);
+	Float minDistance = _params._itemRadius * 2.0;
+	if (iterationCount <= 0 || minDistance <= 0.0 || itemCount < 2)
+		return true;
+	
+	// Row of each item, items only collide with items in the same row (of any stack in the grid)
+	maxon::BaseArray<Int32> itemRows;
+	if (!itemRows.Resize(itemCount))
+		return false;
+	
+	auto findRows = [this, &itemRows](Int start, Int end) -> Bool
 	{
-		// Iterate items in row
-		// Create positions for current row
-		Int32 itemIndex = 0;
-		for (StackItemArray::Iterator item = row->Begin(); item != row->End(); ++item, itemIndex++)
+		Int32 stackIndex = 0;
+		Int32 rowIndex = 0;
+		Int indexInRow = 0;
+		FindItem(start, stackIndex, rowIndex, indexInRow);
+		Int rowEnd = GetStackOffset(stackIndex) + GetRowOffset(rowIndex) + GetRowItemCount(rowIndex);
+		
+		for (Int itemIndex = start; itemIndex < end; ++itemIndex)
 		{
-			// Compute rotation matrix & set to item
-			Matrix rotMatrix = HPBToMatrix(Vector(_random.Get11() * _params._randomRot, 0.0, 0.0), ROTATIONORDER_HPB);
-			item->mg = rotMatrix;
-			
-			// Compute matrix offset
-			if (_params._basePath)
+			// Continue with next row, or first row of the next stack
+			if (itemIndex >= rowEnd)
 			{
-				// Calculate item's relative offset on the spline
-				Float relOffset = _splineLengthData->UniformToNatural((relDistance * itemIndex) + (relDistance * 0.5 * rowIndex));
+				rowIndex = (rowIndex + 1 < _rowCount) ? rowIndex + 1 : 0;
+				rowEnd = itemIndex + GetRowItemCount(rowIndex);
+			}
+			itemRows[itemIndex] = rowIndex;
+		}
+		return true;
+	};
+	if (!ParallelForRanges(itemCount, CANSTACK_MIN_ITEMS_PER_THREAD, findRows))
+		return false;
+	
+	// Positions of the current and the next iteration
+	maxon::BaseArray<Vector> positions;
+	maxon::BaseArray<Vector> settledPositions;
+	if (!positions.Resize(itemCount) || !settledPositions.Resize(itemCount))
+		return false;
+	for (Int itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+		positions[itemIndex] = GetStoredPosition(itemIndex);
+	
+	StackSpatialIndex spatialIndex;
+	Vector *currentPositions = positions.GetFirst();
+	Vector *nextPositions = settledPositions.GetFirst();
+	for (Int32 iteration = 0; iteration < iterationCount; ++iteration)
+	{
+		// Items move less than their radius per iteration, but neighbourhoods still change, so sort them into the grid again
+		if (!spatialIndex.Build(currentPositions, itemCount, minDistance))
+			return false;
+		
+		auto settleRange = [this, &spatialIndex, &itemRows, currentPositions, nextPositions, minDistance](Int start, Int end) -> Bool
+		{
+			for (Int itemIndex = start; itemIndex < end; ++itemIndex)
+			{
+				const Vector &position = currentPositions[itemIndex];
+				Matrix itemMg = GetStoredMatrix(itemIndex);
+				const Vector &up = itemMg.v2;
+				Int32 rowIndex = itemRows[itemIndex];
+				Vector correction;
 				
-				// Get values we need to compute position of item
-				Vector splinePosition = _params._basePath->GetSplinePoint(relOffset);			// Position of point on spline
-				Vector splineTangent = _params._basePath->GetSplineTangent(relOffset);		// Tangent of point on spline (Z axis for item)
-				Vector splineCrossTangent = Cross(splineTangent, Vector(0.0, 1.0, 0.0));	// Cross product of tangent and Y axis (X axis for item)
-
-				// Calculate position along spline
-				item->mg.off = splinePosition;
-				item->mg.off.y += _params._rowHeight * rowIndex;	// Offset to Y direction
-				item->mg.off += splineCrossTangent * _random.Get11() * _params._randomOffX;	// Randomly offset to the sides of the spline
-				item->mg.off += splineTangent * _random.Get11() * _params._randomOffZ;	// Randomly offset along spline
+				spatialIndex.ForEachInRadius(position, minDistance, [&](Int neighborIndex, const Vector &neighborPosition)
+				{
+					if (neighborIndex == itemIndex || itemRows[neighborIndex] != rowIndex)
+						return;
+					
+					// Distance in the plane of the row
+					Vector delta = position - neighborPosition;
+					delta -= up * Dot(delta, up);
+					Float distance = delta.GetLength();
+					if (distance >= minDistance)
+						return;
+					
+					// Items at the same position are pushed apart along the row, the lower index to the front
+					Vector direction = (distance > 1e-9) ? delta / distance : itemMg.v3 * ((itemIndex < neighborIndex) ? -1.0 : 1.0);
+					correction += direction * ((minDistance - distance) * 0.5);
+				});
 				
-				// Transform into global space
-				item->mg = splineMg * item->mg;
+				nextPositions[itemIndex] = position + correction;
 			}
-			else
+			return true;
+		};
+		if (!ParallelForRanges(itemCount, CANSTACK_MIN_ITEMS_PER_THREAD, settleRange))
+			return false;
+		
+		Vector *swap = currentPositions;
+		currentPositions = nextPositions;
+		nextPositions = swap;
+	}
+	
+	if (!_params._compactItems)
+	{
+		for (Int itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+			_items[itemIndex].mg.off = currentPositions[itemIndex];
+		return true;
+	}
+	
+	// Compact items on a path spline are stored relative to the spline
+	Matrix invertedSplineMg = _params._basePath ? ~_params._basePathMg : Matrix();
+	for (Int itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+		SetCompactItem(_compactItems[itemIndex], invertedSplineMg * currentPositions[itemIndex], _compactItems[itemIndex].heading);
+	
+	return true;
+}
+
+
+Bool CanStackGenerator::GenerateAttributes()
+{
+	UInt32 seed = _params._randomSeed ^ CANSTACK_ATTRIBUTE_SEED_SALT;
+	Int32 variationCount = ClampValue(_params._variationCount, (Int32)1, CANSTACK_MAX_VARIATIONS);
+	
+	// Upper bound of each variation's share of the range [0, totalWeight). If all weights are 0, all variations are equally likely.
+	Float cumulativeWeights[CANSTACK_MAX_VARIATIONS];
+	Float totalWeight = 0.0;
+	for (Int32 variationIndex = 0; variationIndex < variationCount; ++variationIndex)
+	{
+		totalWeight += _params._variationWeights[variationIndex];
+		cumulativeWeights[variationIndex] = totalWeight;
+	}
+	if (totalWeight <= 0.0)
+	{
+		for (Int32 variationIndex = 0; variationIndex < variationCount; ++variationIndex)
+			cumulativeWeights[variationIndex] = (Float)(variationIndex + 1);
+		totalWeight = (Float)variationCount;
+	}
+	
+	// Like the layout, attributes only depend on the item index
+	auto generateRange = [this, seed, variationCount, &cumulativeWeights, totalWeight](Int start, Int end) -> Bool
+	{
+		for (Int itemIndex = start; itemIndex < end; ++itemIndex)
+		{
+			// Weighted choice: Find the variation whose share contains the random value
+			Float variationRandom = (StackRandom11(seed, itemIndex, STACKATTRIBUTE_VARIATION) * 0.5 + 0.5) * totalWeight;
+			Int32 variationIndex = 0;
+			while (variationIndex < variationCount - 1 && variationRandom >= cumulativeWeights[variationIndex])
+				variationIndex++;
+			
+			_itemVariations[itemIndex] = variationIndex;
+			_itemRandomValues[itemIndex] = StackRandom11(seed, itemIndex, STACKATTRIBUTE_VALUE) * 0.5 + 0.5;
+		}
+		return true;
+	};
+	
+	return ParallelForRanges(GetItemCount(), CANSTACK_MIN_ITEMS_PER_THREAD, generateRange);
+}
+
+
+void CanStackGenerator::FindItem(Int index, Int32 &stackIndex, Int32 &rowIndex, Int &indexInRow) const
+{
+	// Find stack
+	stackIndex = (Int32)(index / _stackItemCount);
+	Int stackStart = index - GetStackOffset(stackIndex);
+	
+	// Find row: The items from the item to the top of the complete pyramid form a smaller pyramid, whose size tells the row
+	Int remainingCount = GetPyramidItemCount(_params._shape, _params._baseCount) - stackStart;
+	rowIndex = ClampValue((Int32)(_params._baseCount - FindPyramidSize(_params._shape, remainingCount)), (Int32)0, Max(_rowCount - 1, (Int32)0));
+	
+	indexInRow = stackStart - GetRowOffset(rowIndex);
+}
+
+
+void CanStackGenerator::SplitRowIndex(Int32 rowIndex, Int indexInRow, Int32 &depthRowIndex, Int32 &indexInDepthRow) const
+{
+	// Walls and square layers have depth rows of equal length
+	if (_params._shape != STACK_SHAPE_HEX)
+	{
+		Int32 depthRowItemCount = GetDepthRowItemCount(rowIndex, 0);
+		depthRowIndex = (Int32)(indexInRow / depthRowItemCount);
+		indexInDepthRow = (Int32)(indexInRow % depthRowItemCount);
+		return;
+	}
+	
+	// In hex layers, each depth row is 1 shorter than the previous one, so the depth rows form a wall.
+	// The items from the item to the end of the layer form a smaller wall, whose size tells the depth row.
+	Int layerSize = _params._baseCount - rowIndex;
+	Int remainingSize = FindPyramidSize(STACK_SHAPE_WALL, GaussSum(layerSize) - indexInRow);
+	depthRowIndex = (Int32)(layerSize - remainingSize);
+	indexInDepthRow = (Int32)(indexInRow - (GaussSum(layerSize) - GaussSum(remainingSize)));
+}
+
+
+Bool CanStackGenerator::GenerateItems(Int start, Int end, Float distance, Float relDistance, const Matrix &splineMg)
+{
+	if (start >= end)
+		return true;
+	
+	// Straight stacks have their own kernel
+	if (!_params._basePath)
+		return GenerateStraightItems(start, end, distance);
+	
+	// Find stack and row of first item in range. Only walls can follow a spline, so each row is a single line of items.
+	Int32 stackIndex = 0;
+	Int32 rowIndex = 0;
+	Int itemIndex = 0;
+	FindItem(start, stackIndex, rowIndex, itemIndex);
+	Vector gridOffset = GetGridOffset(stackIndex);
+	Int rowItemCount = GetRowItemCount(rowIndex);
+	
+	// Iterate items in range
+	for (Int index = start; index < end; ++index)
+	{
+		// Continue with next row when current row is full
+		if (itemIndex >= rowItemCount)
+		{
+			rowIndex++;
+			itemIndex = 0;
+			
+			// Continue with next stack when last row is full
+			if (rowIndex >= _rowCount)
+			{
+				rowIndex = 0;
+				stackIndex++;
+				gridOffset = GetGridOffset(stackIndex);
+			}
+			
+			rowItemCount = GetRowItemCount(rowIndex);
+		}
+		
+		// Compute rotation
+		Float heading = StackRandom11(_params._randomSeed, index, STACKRANDOM_ROT) * _params._randomRot;
+		
+		// Calculate item's relative offset on the spline
+		Float relOffset = (relDistance * itemIndex) + (relDistance * 0.5 * rowIndex);
+		
+		// Get values we need to compute position of item
+		Vector splinePosition;		// Position of point on spline
+		Vector splineTangent;			// Tangent of point on spline (Z axis for item)
+		_splineSamples.Sample(relOffset, splinePosition, splineTangent);
+		Vector splineCrossTangent = Cross(splineTangent, Vector(0.0, 1.0, 0.0));	// Cross product of tangent and Y axis (X axis for item)
+		
+		// Calculate position along spline
+		Vector position = splinePosition;
+		position.y += _params._rowHeight * rowIndex;	// Offset to Y direction
+		position += splineCrossTangent * StackRandom11(_params._randomSeed, index, STACKRANDOM_OFFX) * _params._randomOffX;	// Randomly offset to the sides of the spline
+		position += splineTangent * StackRandom11(_params._randomSeed, index, STACKRANDOM_OFFZ) * _params._randomOffZ;	// Randomly offset along spline
+		position += gridOffset;	// Offset parallel to the spline, in spline space
+		
+		// Compact items stay in spline space, full items are transformed into global space
+		if (_params._compactItems)
+		{
+			SetCompactItem(_compactItems[index], position, heading);
+		}
+		else
+		{
+			Matrix itemMg = HPBToMatrix(Vector(heading, 0.0, 0.0), ROTATIONORDER_HPB);
+			itemMg.off = position;
+			_items[index].mg = splineMg * itemMg;
+		}
+		
+		itemIndex++;
+	}
+	
+	return true;
+}
+
+
+Bool CanStackGenerator::GenerateStraightItems(Int start, Int end, Float distance)
+{
+	// Values of all items in a block, one array per component. The loops over these arrays
+	// have no branches and no dependencies between items, so the compiler can vectorize them.
+	Float posX[CANSTACK_KERNEL_BLOCK_SIZE];
+	Float posY[CANSTACK_KERNEL_BLOCK_SIZE];
+	Float posZ[CANSTACK_KERNEL_BLOCK_SIZE];
+	Float headingSin[CANSTACK_KERNEL_BLOCK_SIZE];
+	Float headingCos[CANSTACK_KERNEL_BLOCK_SIZE];
+	
+	// Spacing of depth rows and offset of each layer, relative to the item distance
+	Float depthRowStepX = 0.0;		// Distance between depth rows
+	Float depthRowShiftZ = 0.0;		// Shift of each depth row along the row
+	Float layerShiftX = 0.0;			// Shift of each layer across the row
+	switch (_params._shape)
+	{
+		case STACK_SHAPE_SQUARE:
+			depthRowStepX = 1.0;
+			layerShiftX = 0.5;
+			break;
+			
+		case STACK_SHAPE_HEX:
+			depthRowStepX = Sqrt(3.0) * 0.5;
+			depthRowShiftZ = 0.5;
+			layerShiftX = Sqrt(3.0) / 6.0;
+			break;
+	}
+	
+	// Find stack, row and depth row of first item in range
+	Int32 stackIndex = 0;
+	Int32 rowIndex = 0;
+	Int indexInRow = 0;
+	Int32 depthRowIndex = 0;
+	Int32 itemIndex = 0;
+	FindItem(start, stackIndex, rowIndex, indexInRow);
+	SplitRowIndex(rowIndex, indexInRow, depthRowIndex, itemIndex);
+	Vector gridOffset = GetGridOffset(stackIndex);
+	Int32 depthRowCount = GetDepthRowCount(rowIndex);
+	Int32 depthRowItemCount = GetDepthRowItemCount(rowIndex, depthRowIndex);
+	
+	for (Int blockStart = start; blockStart < end; blockStart += CANSTACK_KERNEL_BLOCK_SIZE)
+	{
+		Int blockCount = Min(CANSTACK_KERNEL_BLOCK_SIZE, end - blockStart);
+		
+		// Layout position of each item, only depends on stack, row, depth row and index in depth row
+		for (Int i = 0; i < blockCount; ++i)
+		{
+			// Continue with next depth row when current one is full, with next row when last depth row is full, and with next stack when last row is full
+			if (itemIndex >= depthRowItemCount)
 			{
-				// Calculate item's position
-				item->mg.off = Vector(_random.Get11() * _params._randomOffX, _params._rowHeight * rowIndex, distance * itemIndex + distance * rowIndex * 0.5 + _random.Get11() * _params._randomOffZ);
+				itemIndex = 0;
+				depthRowIndex++;
+				if (depthRowIndex >= depthRowCount)
+				{
+					depthRowIndex = 0;
+					rowIndex++;
+					if (rowIndex >= _rowCount)
+					{
+						rowIndex = 0;
+						stackIndex++;
+						gridOffset = GetGridOffset(stackIndex);
+					}
+					depthRowCount = GetDepthRowCount(rowIndex);
+				}
+				depthRowItemCount = GetDepthRowItemCount(rowIndex, depthRowIndex);
 			}
+			
+			posX[i] = distance * (depthRowStepX * depthRowIndex + layerShiftX * rowIndex) + gridOffset.x;
+			posY[i] = _params._rowHeight * rowIndex;
+			posZ[i] = distance * itemIndex + distance * (depthRowShiftZ * depthRowIndex + rowIndex * 0.5) + gridOffset.z;
+			
+			itemIndex++;
+		}
+		
+		// Random values, only depend on the item index
+		for (Int i = 0; i < blockCount; ++i)
+		{
+			Int index = blockStart + i;
+			posX[i] += StackRandom11(_params._randomSeed, index, STACKRANDOM_OFFX) * _params._randomOffX;
+			posZ[i] += StackRandom11(_params._randomSeed, index, STACKRANDOM_OFFZ) * _params._randomOffZ;
+			headingSin[i] = StackRandom11(_params._randomSeed, index, STACKRANDOM_ROT) * _params._randomRot;
+		}
+		
+		// Compact items keep the heading angle, the matrix is only built when it's needed
+		if (_params._compactItems)
+		{
+			CompactStackItem *compactItem = &_compactItems[blockStart];
+			for (Int i = 0; i < blockCount; ++i, ++compactItem)
+				SetCompactItem(*compactItem, Vector(posX[i], posY[i], posZ[i]), headingSin[i]);
+			continue;
+		}
+		
+		// Heading only rotation needs just one sine and cosine per item
+		for (Int i = 0; i < blockCount; ++i)
+		{
+			Float heading = headingSin[i];
+			headingSin[i] = Sin(heading);
+			headingCos[i] = Cos(heading);
+		}
+		
+		// Write matrices, same as MatrixRotY(heading) with the item position as offset
+		StackItem *item = &_items[blockStart];
+		for (Int i = 0; i < blockCount; ++i, ++item)
+		{
+			item->mg.off = Vector(posX[i], posY[i], posZ[i]);
+			item->mg.v1 = Vector(headingCos[i], 0.0, -headingSin[i]);
+			item->mg.v2 = Vector(0.0, 1.0, 0.0);
+			item->mg.v3 = Vector(headingSin[i], 0.0, headingCos[i]);
 		}
 	}
 	
@@ -112,81 +659,186 @@ Bool CanStackGenerator::GenerateStack()
 }
 
 
-BaseObject *CanStackGenerator::BuildStackGeometry(BaseObject *originalObject, const Matrix &mg, Bool useRenderInstances)
+/// Sets the display color of a built item, blended between two colors by the item's random value
+/// @param[in] item								The item object
+/// @param[in] settings						Build settings with the colors
+/// @param[in] randomValue				The item's random value
+static void SetItemColor(BaseObject *item, const StackBuildSettings &settings, Float randomValue)
+{
+	BaseContainer *itemData = item->GetDataInstance();
+	itemData->SetInt32(ID_BASEOBJECT_USECOLOR, ID_BASEOBJECT_USECOLOR_ALWAYS);
+	itemData->SetVector(ID_BASEOBJECT_COLOR, Blend(settings._color1, settings._color2, randomValue));
+}
+
+
+/// Gives a reused item the display color settings of its source object again, after it has had a random color
+/// @param[in] item								The item object
+/// @param[in] source							The object the item has been cloned from
+static void ResetItemColor(BaseObject *item, BaseObject *source)
+{
+	BaseContainer *itemData = item->GetDataInstance();
+	const BaseContainer *sourceData = source->GetDataInstance();
+	itemData->SetInt32(ID_BASEOBJECT_USECOLOR, sourceData->GetInt32(ID_BASEOBJECT_USECOLOR, ID_BASEOBJECT_USECOLOR_OFF));
+	itemData->SetVector(ID_BASEOBJECT_COLOR, sourceData->GetVector(ID_BASEOBJECT_COLOR));
+}
+
+
+/// Shows or hides a built item in the editor and in renderings
+/// @param[in] item								The item object
+/// @param[in] visible						True to show the item, false to hide it
+static void SetItemVisibility(BaseObject *item, Bool visible)
+{
+	item->SetEditorMode(visible ? MODE_UNDEF : MODE_OFF);
+	item->SetRenderMode(visible ? MODE_UNDEF : MODE_OFF);
+}
+
+
+BaseObject *CanStackGenerator::BuildStackGeometry(BaseObject *originalObject, const Matrix &mg, const StackBuildSettings &settings, maxon::BaseArray<BaseObject*> *references, Int visibleCount)
 {
+	// Take ownership of reusable references right away, so they get freed if anything goes wrong or they are not needed
+	AutoAlloc<BaseObject> unusedReferences(Onull);
+	if (!unusedReferences)
+		return nullptr;
+	if (references)
+	{
+		for (Int referenceIndex = 0; referenceIndex < references->GetCount(); ++referenceIndex)
+		{
+			if ((*references)[referenceIndex])
+				(*references)[referenceIndex]->InsertUnderLast(unusedReferences);
+		}
+	}
+	
+	// Forget about the previously built hierarchy
+	Int32 variationCount = Max(_params._variationCount, (Int32)1);
+	_buildSettings = settings;
+	_builtItems.Flush();
+	_builtReferences.Flush();
+	_builtMg = mg;
+	_visibleCount = visibleCount;
+	
 	// Create parent object
 	AutoAlloc<BaseObject> resultParent(Onull);
 	if (!resultParent)
 		return nullptr;
 	
-	BaseObject* objectToClone = nullptr;
+	// Each variation has its own source object, those are the original object and its next siblings.
+	// We'll clone either the source object, or - if it is a render instance - the object that's linked.
+	maxon::BaseArray<BaseObject*> objectsToClone;
+	BaseObject *source = originalObject;
+	for (Int32 variationIndex = 0; variationIndex < variationCount; ++variationIndex)
+	{
+		BaseObject *objectToClone = GetReferenceObject(source);
+		
+		// Cancel if nothing to clone
+		if (!objectToClone || !objectsToClone.Append(objectToClone))
+			return nullptr;
+		
+		source = source->GetNext();
+	}
 	
-	// We'll clone either the original child object, or - if child is a render instance - the object that's linked
-	if (originalObject->GetType() == Oinstance && originalObject->GetDataInstance()->GetBool(INSTANCEOBJECT_RENDERINSTANCE))
-		objectToClone = originalObject->GetDataInstance()->GetObjectLink(INSTANCEOBJECT_LINK, originalObject->GetDocument());
-	else
-		objectToClone = originalObject;
+	// A box proxy replaces all items
+	if (settings._lodMode == STACK_LOD_MODE_BOX)
+	{
+		BaseObject *proxy = BuildStackProxy(objectsToClone, mg);
+		if (!proxy)
+			return nullptr;
+		
+		proxy->InsertUnder(resultParent);
+		return resultParent.Release();
+	}
 	
-	// Cancel if nothing to clone
-	if (!objectToClone)
+	// Find out which items to build
+	if (!CollectBuiltItems(settings))
 		return nullptr;
 	
-	// Store object name (plus an extra space)
-	String originalName = objectToClone->GetName() + " ";
+	// Per variation: Built index of the clone that all instances of the variation link to
+	if (!_builtReferences.Resize(variationCount))
+		return nullptr;
+	for (Int32 variationIndex = 0; variationIndex < variationCount; ++variationIndex)
+		_builtReferences[variationIndex] = NOTOK;
+	
+	// Per variation: The previous clone, if it can be reused, and the new clone (if using render instances, all successive instances must link to it)
+	maxon::BaseArray<BaseObject*> reusableReference;
+	maxon::BaseArray<BaseObject*> firstItems;
+	if (!reusableReference.Resize(variationCount) || !firstItems.Resize(variationCount))
+		return nullptr;
+	for (Int32 variationIndex = 0; variationIndex < variationCount; ++variationIndex)
+	{
+		reusableReference[variationIndex] = (references && variationIndex < references->GetCount()) ? (*references)[variationIndex] : nullptr;
+		firstItems[variationIndex] = nullptr;
+	}
 	
 	// Calculate inversion of 'mg' (needed to transform item matrix from global space to generator's local space if path spline is used)
 	Matrix invertedMg = ~mg;
 	
-	// Counter for total number of created new items
-	Int32 newItemCount = 0;
-	
-	// Store pointer to first created object (if using render instances, all successive instances must link to the first object)
-	BaseObject *firstItem = nullptr;
+	// Store pointer to last inserted object (inserting after it is cheaper than InsertUnderLast(), which has to find the end of the list every time)
+	BaseObject *lastItem = nullptr;
 
-	// Iterate rows in stack
-	for (StackRowArray::Iterator row = _array.Begin(); row != _array.End(); ++row)
+	// Iterate all items to build, row after row
+	for (Int builtIndex = 0; builtIndex < _builtItems.GetCount(); ++builtIndex)
 	{
-		// Iterate items in row
-		for (StackItemArray::Iterator item = row->Begin(); item != row->End(); ++item)
+		Int itemIndex = _builtItems[builtIndex];
+		Int32 variationIndex = _itemVariations[itemIndex];
+		BaseObject *newItem = nullptr;
+		Bool reused = false;
+		
+		// First object of each variation always has to be a clone, even if we use render instances
+		if (settings._useRenderInstances && firstItems[variationIndex])
 		{
-			BaseObject *newItem = nullptr;
+			// Create render instance of the first clone of this item's variation (all instances must link to the first item of their variation)
+			newItem = BaseObject::Alloc(Oinstance);
+			if (!newItem)
+				return nullptr;
 			
-			// First object always has to be a clone, even if we use render instances
-			if (useRenderInstances && newItemCount > 0)
+			// Set instance properties
+			BaseContainer *newItemData = newItem->GetDataInstance();
+			newItemData->SetLink(INSTANCEOBJECT_LINK, firstItems[variationIndex]);
+			newItemData->SetBool(INSTANCEOBJECT_RENDERINSTANCE, true);
+		}
+		else
+		{
+			if (reusableReference[variationIndex])
 			{
-				// Create render instance of original object
-				newItem = BaseObject::Alloc(Oinstance);
-				if (!newItem)
-					return nullptr;
-				
-				// Set instance properties
-				BaseContainer *newItemData = newItem->GetDataInstance();
-				newItemData->SetLink(INSTANCEOBJECT_LINK, firstItem);
-				newItemData->SetBool(INSTANCEOBJECT_RENDERINSTANCE, true);
+				// Use existing clone of the source object
+				newItem = reusableReference[variationIndex];
+				newItem->Remove();
+				reusableReference[variationIndex] = nullptr;
+				reused = true;
 			}
 			else
 			{
-				// Create clone of original object
-				newItem = static_cast<BaseObject*>(objectToClone->GetClone(COPYFLAGS_0, nullptr));
+				// Create clone of source object
+				newItem = static_cast<BaseObject*>(objectsToClone[variationIndex]->GetClone(COPYFLAGS_0, nullptr));
 				if (!newItem)
 					return nullptr;
-				
-				// Store pointer to clone (needed in case we use render instances)
-				firstItem = newItem;
 			}
 			
-			// Increase counter
-			newItemCount++;
-			
-			// Set clone position according to item in stack data
-			if (_params._basePath)
-				newItem->SetMg(invertedMg * item->mg);	// Transform matrix from global to local generator space
-			else
-				newItem->SetMl(item->mg);								// Simply set local matrix
-			
-			// Insert clone as last child under parent Null
-			newItem->InsertUnderLast(resultParent);
+			// Remember first clone of each variation (needed in case we use render instances, and for reusing it in the next build)
+			if (!firstItems[variationIndex])
+			{
+				firstItems[variationIndex] = newItem;
+				_builtReferences[variationIndex] = builtIndex;
+			}
 		}
+		
+		// Set clone position according to item in stack data
+		newItem->SetMl(GetItemMatrix(itemIndex, invertedMg));
+		
+		// Hide items that are not grown yet. A reused reference might have been hidden before.
+		SetItemVisibility(newItem, IsItemVisible(itemIndex, visibleCount));
+		
+		// Pass item attributes to the object. A reused reference might still have a random color from before.
+		if (settings._itemColors)
+			SetItemColor(newItem, settings, _itemRandomValues[itemIndex]);
+		else if (reused)
+			ResetItemColor(newItem, objectsToClone[variationIndex]);
+		
+		// Insert clone as last child under parent Null
+		if (lastItem)
+			newItem->InsertAfter(lastItem);
+		else
+			newItem->InsertUnder(resultParent);
+		lastItem = newItem;
 	}
 	
 	// Return parent Null and give up ownership
@@ -194,20 +846,427 @@ BaseObject *CanStackGenerator::BuildStackGeometry(BaseObject *originalObject, co
 }
 
 
-Bool CanStackGenerator::ResizeStack(Int32 baseCount, Int32 rowCount)
+Bool CanStackGenerator::CollectBuiltItems(const StackBuildSettings &settings)
+{
+	// Build all items
+	if (!settings._cullHidden && settings._lodMode != STACK_LOD_MODE_SHELL)
+	{
+		if (!_builtItems.Resize(GetItemCount()))
+			return false;
+		
+		for (Int itemIndex = 0; itemIndex < GetItemCount(); ++itemIndex)
+			_builtItems[itemIndex] = itemIndex;
+		
+		return true;
+	}
+	
+	// Outer shell of a wall: The complete base and top rows, and the first and last item of all rows in between
+	if (settings._lodMode == STACK_LOD_MODE_SHELL && _params._shape == STACK_SHAPE_WALL)
+	{
+		for (Int32 stackIndex = 0; stackIndex < GetStackCount(); ++stackIndex)
+		{
+			for (Int32 rowIndex = 0; rowIndex < _rowCount; ++rowIndex)
+			{
+				Int rowOffset = GetStackOffset(stackIndex) + GetRowOffset(rowIndex);
+				Int rowItemCount = GetRowItemCount(rowIndex);
+				
+				if ((rowIndex == 0) || (rowIndex == _rowCount - 1) || (rowItemCount <= 2))
+				{
+					for (Int indexInRow = 0; indexInRow < rowItemCount; ++indexInRow)
+					{
+						if (!_builtItems.Append(rowOffset + indexInRow))
+							return false;
+					}
+				}
+				else
+				{
+					if (!_builtItems.Append(rowOffset) || !_builtItems.Append(rowOffset + rowItemCount - 1))
+						return false;
+				}
+			}
+		}
+		return true;
+	}
+	
+	// All items that are not hidden. For 3D shapes, that's also the outer shell.
+	for (Int32 stackIndex = 0; stackIndex < GetStackCount(); ++stackIndex)
+	{
+		Int itemIndex = GetStackOffset(stackIndex);
+		for (Int32 rowIndex = 0; rowIndex < _rowCount; ++rowIndex)
+		{
+			for (Int32 depthRowIndex = 0; depthRowIndex < GetDepthRowCount(rowIndex); ++depthRowIndex)
+			{
+				Int32 depthRowItemCount = GetDepthRowItemCount(rowIndex, depthRowIndex);
+				for (Int32 indexInDepthRow = 0; indexInDepthRow < depthRowItemCount; ++indexInDepthRow, ++itemIndex)
+				{
+					if (!IsItemHidden(rowIndex, depthRowIndex, indexInDepthRow) && !_builtItems.Append(itemIndex))
+						return false;
+				}
+			}
+		}
+	}
+	
+	return true;
+}
+
+
+BaseObject *CanStackGenerator::BuildStackProxy(const maxon::BaseArray<BaseObject*> &objectsToClone, const Matrix &mg) const
 {
-	// Resize stack
-	if (!_array.Resize(Min(baseCount, rowCount)))
+	// Bounding box of each stacked object and its children
+	maxon::BaseArray<Vector> objectCenters;
+	maxon::BaseArray<Vector> objectRads;
+	if (!objectCenters.Resize(objectsToClone.GetCount()) || !objectRads.Resize(objectsToClone.GetCount()))
+		return nullptr;
+	
+	for (Int variationIndex = 0; variationIndex < objectsToClone.GetCount(); ++variationIndex)
+	{
+		MinMax objectBox;
+		objectCenters[variationIndex] = Vector();
+		objectRads[variationIndex] = Vector();
+		if (GetCachedHierarchyBoundingBox(objectsToClone[variationIndex], objectBox))
+		{
+			objectCenters[variationIndex] = objectBox.GetMp();
+			objectRads[variationIndex] = objectBox.GetRad();
+		}
+	}
+	
+	// Add the rotated bounding box of every item
+	Matrix invertedMg = ~mg;
+	MinMax stackBox;
+	stackBox.Init();
+	for (Int itemIndex = 0; itemIndex < GetItemCount(); ++itemIndex)
+	{
+		Int32 variationIndex = _itemVariations[itemIndex];
+		AddTransformedBoundingBox(stackBox, GetItemMatrix(itemIndex, invertedMg), objectCenters[variationIndex], objectRads[variationIndex]);
+	}
+	
+	BaseObject *proxy = BaseObject::Alloc(Ocube);
+	if (!proxy)
+		return nullptr;
+	
+	// Fit cube to bounding box
+	proxy->GetDataInstance()->SetVector(PRIM_CUBE_LEN, stackBox.GetRad() * 2.0);
+	proxy->SetRelPos(stackBox.GetMp());
+	proxy->SetName(objectsToClone[0]->GetName() + " Proxy");
+	
+	return proxy;
+}
+
+
+Bool CanStackGenerator::DetachReferences(BaseObject *result, maxon::BaseArray<BaseObject*> &references) const
+{
+	references.Flush();
+	
+	// Box proxies don't contain a clone
+	if (!result || _builtReferences.GetCount() == 0)
+		return true;
+	
+	if (!references.Resize(_builtReferences.GetCount()))
 		return false;
 	
-	// Resize rows in stack
-	Int32 rowIndex = 0;
-	for (StackRowArray::Iterator row = _array.Begin(); row != _array.End() && rowIndex < rowCount; ++row, rowIndex++)
+	Int remainingCount = 0;
+	for (Int variationIndex = 0; variationIndex < _builtReferences.GetCount(); ++variationIndex)
+	{
+		references[variationIndex] = nullptr;
+		if (_builtReferences[variationIndex] != NOTOK)
+			remainingCount++;
+	}
+	
+	// Find the first clone of each variation. They are usually among the first items, so stop as soon as all have been found.
+	// The items may have been generated again since the hierarchy was built, so only the remembered built indices are reliable.
+	Int builtIndex = 0;
+	BaseObject *item = result->GetDown();
+	while (item && remainingCount > 0)
+	{
+		BaseObject *nextItem = item->GetNext();
+		
+		for (Int variationIndex = 0; variationIndex < _builtReferences.GetCount(); ++variationIndex)
+		{
+			if (_builtReferences[variationIndex] == builtIndex)
+			{
+				item->Remove();
+				references[variationIndex] = item;
+				remainingCount--;
+				break;
+			}
+		}
+		
+		item = nextItem;
+		builtIndex++;
+	}
+	
+	return true;
+}
+
+
+BaseObject *CanStackGenerator::GetReferenceObject(BaseObject *originalObject)
+{
+	if (!originalObject)
+		return nullptr;
+	
+	// If original object is a render instance, items should instantiate the linked object instead
+	if (originalObject->GetType() == Oinstance && originalObject->GetDataInstance()->GetBool(INSTANCEOBJECT_RENDERINSTANCE))
+		return originalObject->GetDataInstance()->GetObjectLink(INSTANCEOBJECT_LINK, originalObject->GetDocument());
+	
+	return originalObject;
+}
+
+
+Bool CanStackGenerator::GetInstanceMatrices(const Matrix &mg, maxon::BaseArray<Matrix> &matrices) const
+{
+	if (!matrices.Resize(GetItemCount()))
+		return false;
+	
+	// Transform all item matrices into generator space in one go
+	Matrix invertedMg = ~mg;
+	for (Int itemIndex = 0; itemIndex < GetItemCount(); ++itemIndex)
+	{
+		matrices[itemIndex] = GetItemMatrix(itemIndex, invertedMg);
+	}
+	
+	return true;
+}
+
+
+const StackSpatialIndex *CanStackGenerator::GetSpatialIndex()
+{
+	if (!_initialized || !_generated)
+		return nullptr;
+	
+	// Items only change together with the fingerprint
+	if (_spatialIndexFingerprint == _fingerprint && _spatialIndex.GetCount() == GetItemCount())
+		return &_spatialIndex;
+	
+	_spatialIndexFingerprint = 0;
+	
+	maxon::BaseArray<Vector> positions;
+	if (!positions.Resize(GetItemCount()))
+		return nullptr;
+	for (Int itemIndex = 0; itemIndex < GetItemCount(); ++itemIndex)
+		positions[itemIndex] = GetStoredPosition(itemIndex);
+	
+	// About one item per cell: Use the item size if it's known, otherwise the distance between the first two items
+	Float cellSize = _params._itemRadius * 2.0;
+	if (cellSize <= 0.0 && GetItemCount() > 1)
+		cellSize = (positions[1] - positions[0]).GetLength();
+	if (cellSize <= 0.0)
+		cellSize = Max(_params._rowHeight, (Float)1.0);
+	
+	if (!_spatialIndex.Build(positions.GetFirst(), positions.GetCount(), cellSize))
+		return nullptr;
+	
+	_spatialIndexFingerprint = _fingerprint;
+	return &_spatialIndex;
+}
+
+
+Bool CanStackGenerator::FindItemsInRadius(const Vector &center, Float radius, const Matrix &mg, maxon::BaseArray<Int> &itemIndices)
+{
+	itemIndices.Flush();
+	
+	const StackSpatialIndex *spatialIndex = GetSpatialIndex();
+	if (!spatialIndex)
+		return false;
+	
+	// Items on a path spline are stored in global space
+	Vector itemSpaceCenter = _params._basePath ? mg * center : center;
+	
+	Bool success = true;
+	spatialIndex->ForEachInRadius(itemSpaceCenter, radius, [&itemIndices, &success](Int itemIndex, const Vector &position)
+	{
+		success &= itemIndices.Append(itemIndex) != nullptr;
+	});
+	
+	return success;
+}
+
+
+Int CanStackGenerator::FindNearestItem(const Vector &center, Float maxRadius, const Matrix &mg)
+{
+	const StackSpatialIndex *spatialIndex = GetSpatialIndex();
+	if (!spatialIndex)
+		return NOTOK;
+	
+	// Items on a path spline are stored in global space
+	Vector itemSpaceCenter = _params._basePath ? mg * center : center;
+	
+	// On equal distance, the lower index wins, so the result doesn't depend on the order of the index
+	Int nearestIndex = NOTOK;
+	Float nearestDistance = 0.0;
+	spatialIndex->ForEachInRadius(itemSpaceCenter, maxRadius, [&nearestIndex, &nearestDistance, &itemSpaceCenter](Int itemIndex, const Vector &position)
+	{
+		Float distance = (position - itemSpaceCenter).GetSquaredLength();
+		if (nearestIndex == NOTOK || distance < nearestDistance || (distance == nearestDistance && itemIndex < nearestIndex))
+		{
+			nearestIndex = itemIndex;
+			nearestDistance = distance;
+		}
+	});
+	
+	return nearestIndex;
+}
+
+
+Bool CanStackGenerator::UpdateStackGeometry(BaseObject *result, const Matrix &mg, const StackBuildSettings &settings, Int visibleCount)
+{
+	if (!result || !_initialized)
+		return false;
+	
+	// Hierarchy has been built with different settings. Box proxies are always rebuilt, it's only one object anyway.
+	if ((settings != _buildSettings) || (settings._lodMode == STACK_LOD_MODE_BOX))
+		return false;
+	
+	// Calculate inversion of 'mg' (needed to transform item matrix from global space to generator's local space if path spline is used)
+	Matrix invertedMg = ~mg;
+	
+	// If neither the items nor the generator have moved (e.g. when only the number of visible items is animated), the matrices are still correct
+	Bool moveItems = (_lastChanges != STACKCHANGE_NONE) || (mg != _builtMg);
+	
+	// Iterate existing items and built item indices side by side
+	Int builtIndex = 0;
+	for (BaseObject *item = result->GetDown(); item; item = item->GetNext(), ++builtIndex)
+	{
+		// Hierarchy has more items than the stack
+		if (builtIndex >= _builtItems.GetCount() || _builtItems[builtIndex] >= GetItemCount())
+			return false;
+		
+		Int itemIndex = _builtItems[builtIndex];
+		if (moveItems)
+		{
+			item->SetMl(GetItemMatrix(itemIndex, invertedMg));
+			
+			// A new seed also changes the random values
+			if (settings._itemColors)
+				SetItemColor(item, settings, _itemRandomValues[itemIndex]);
+		}
+		
+		// Only touch items that appear or disappear
+		Bool visible = IsItemVisible(itemIndex, visibleCount);
+		if (visible != IsItemVisible(itemIndex, _visibleCount))
+			SetItemVisibility(item, visible);
+	}
+	
+	// Hierarchy has fewer items than the stack
+	if (builtIndex != _builtItems.GetCount())
+		return false;
+	
+	_builtMg = mg;
+	_visibleCount = visibleCount;
+	
+	// Indicate that result has changed
+	result->Message(MSG_UPDATE);
+	
+	return true;
+}
+
+
+Bool CanStackGenerator::WriteItems(HyperFile *hf) const
+{
+	if (!hf)
+		return false;
+	
+	// Only write items that are complete. Compact items are not written, they are generated again after loading.
+	// Items that have been read or copied, but not used yet (e.g. the stack was never evaluated), are written again with the fingerprint they have been stored with.
+	Bool hasItems = _initialized && _generated && !_params._compactItems;
+	Bool hasRestoredItems = !hasItems && _restored && _compactItems.GetCount() == 0;
+	Int64 itemCount = (hasItems || hasRestoredItems) ? _items.GetCount() : 0;
+	UInt64 fingerprint = hasItems ? _params.GetLayoutFingerprint() : (hasRestoredItems ? _restoredFingerprint : 0);
+	
+	if (!hf->WriteUInt64(fingerprint))
+		return false;
+	if (!hf->WriteInt64(itemCount))
+		return false;
+	
+	for (Int itemIndex = 0; itemIndex < itemCount; ++itemIndex)
 	{
-		// Each row is 1 smaller than its predecessor
-		if (!row->Resize(_params._baseCount - rowIndex))
+		if (!hf->WriteMatrix(_items[itemIndex].mg))
 			return false;
 	}
 	
 	return true;
 }
+
+
+Bool CanStackGenerator::ReadItems(HyperFile *hf)
+{
+	if (!hf)
+		return false;
+	
+	// Whatever has been generated before is overwritten
+	_restored = false;
+	_generated = false;
+	_initialized = false;
+	_spatialIndexFingerprint = 0;
+	
+	UInt64 fingerprint = 0;
+	Int64 itemCount = 0;
+	if (!hf->ReadUInt64(&fingerprint))
+		return false;
+	if (!hf->ReadInt64(&itemCount) || itemCount < 0)
+		return false;
+	
+	_compactItems.Reset();
+	if (!_items.Resize((Int)itemCount))
+		return false;
+	
+	for (Int itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+	{
+		if (!hf->ReadMatrix(&_items[itemIndex].mg))
+			return false;
+	}
+	
+	// The next InitStack() call decides if the items can be used
+	_restoredFingerprint = fingerprint;
+	_restored = itemCount > 0;
+	
+	return true;
+}
+
+
+Bool CanStackGenerator::CopyFrom(const CanStackGenerator &src, Bool copyItems)
+{
+	// Whatever has been generated before is overwritten
+	_restored = false;
+	_generated = false;
+	_initialized = false;
+	_spatialIndexFingerprint = 0;
+	
+	// Nothing to copy if source has no complete items, or if the copy should not hold them
+	Bool srcComplete = src._initialized && src._generated;
+	if (!copyItems || (!srcComplete && !src._restored))
+		return true;
+	
+	// Copy items in one go. The copy's inputs (spline, child objects) are copies, too, and have different dirty checksums,
+	// so the items are validated by their layout fingerprint in the next InitStack() call.
+	if (!_items.CopyFrom(src._items) || !_compactItems.CopyFrom(src._compactItems))
+		return false;
+	
+	_restoredFingerprint = srcComplete ? src._params.GetLayoutFingerprint() : src._restoredFingerprint;
+	_restored = true;
+	
+	return true;
+}
+
+
+Bool CanStackGenerator::ResizeStack()
+{
+	// Number of rows can't exceed number of items in base row
+	_rowCount = Max(Min(_params._baseCount, _params._rowCount), 0);
+	_stackItemCount = CalculateStackItemCount(_params._shape, _params._baseCount, _params._rowCount);
+	
+	// Resize flat stack array (one allocation for all stacks) and the attribute arrays. Only one of the item arrays is used, free the other one.
+	Int itemCount = CalculateItemCount(_params);
+	if (_params._compactItems)
+	{
+		_items.Reset();
+		if (!_compactItems.Resize(itemCount))
+			return false;
+	}
+	else
+	{
+		_compactItems.Reset();
+		if (!_items.Resize(itemCount))
+			return false;
+	}
+	return _itemVariations.Resize(itemCount) && _itemRandomValues.Resize(itemCount);
+}
@@ -4,6 +4,8 @@
 
 #include "c4d.h"
 #include "ostack.h"
+#include "splinesamplecache.h"
+#include "stackspatialindex.h"
 
 
 /*
@@ -23,27 +25,61 @@
 	- Maximum rowCount is always == baseCount
 	- itemCount per Row is always itemCount of previous row - 1
 	- Total number of items is GaussSum(baseCount)
+ 
+	The 3D shapes work the same way, but each row is a whole layer:
+	- STACK_SHAPE_SQUARE: Layer i is a square of (baseCount - i)^2 items, each item sits in the gap between four items of the layer below
+	- STACK_SHAPE_HEX: Layer i is a hex packed triangle of GaussSum(baseCount - i) items, each item sits in the gap between three items of the layer below
+	Within a layer, items are ordered in depth rows (along X) of items (along Z).
  */
 
 
-/// Structure that holds the data for one item in a stack
+/// Maximum number of variations (stacked objects) a stack can choose from
+static const Int32 CANSTACK_MAX_VARIATIONS = 32;
+
+
+/// Structure that holds the data for one item in a stack.
+/// Other per-item attributes (variation index, random value) are kept in separate arrays in CanStackGenerator, so code that only needs the matrices doesn't have to load them.
 struct StackItem
 {
 	Matrix mg;
 };
 
 
-/// MatrixArray is BaseArray of Matrix. It holds a matrix for each item in a row
+/// StackItemArray is a flat BaseArray of StackItem. It holds all items of all stacks in the grid, stack after stack, and row after row within a stack.
+/// Row 0 (the base row) comes first; use CanStackGenerator::GetStackOffset() and GetRowOffset() to find the first item of a row.
 typedef maxon::BaseArray<StackItem> StackItemArray;
 
 
-/// StackRowArray is a BaseArray of MatrixArray. It holds multiple rows that form the stack.
-typedef maxon::BaseArray<StackItemArray> StackRowArray;
+/// Compact form of a StackItem: Position and heading as 32 bit floats, 16 bytes instead of the 96 bytes of a Matrix.
+/// Items are only rotated around their Y axis in the space they are generated in, so the matrix can always be restored from these values.
+/// Positions are stored relative to the generator for straight stacks, and relative to the path spline for stacks on a spline.
+struct CompactStackItem
+{
+	Float32 posX;
+	Float32 posY;
+	Float32 posZ;
+	Float32 heading;
+};
+
+
+/// CompactStackItemArray is a flat BaseArray of CompactStackItem, in the same order as a StackItemArray
+typedef maxon::BaseArray<CompactStackItem> CompactStackItemArray;
+
+
+/// Flags that describe what changed between two sets of StackParameters
+enum STACKCHANGE
+{
+	STACKCHANGE_NONE				= 0,					///< Nothing changed
+	STACKCHANGE_LAYOUT			= (1 << 0),		///< Item positions or rotations changed, but the set of generated objects is the same
+	STACKCHANGE_STRUCTURE		= (1 << 1),		///< Number of items or type of generated objects changed
+	STACKCHANGE_SOURCE			= (1 << 2)		///< The object that is stacked changed
+} ENUM_END_FLAGS(STACKCHANGE);
 
 
 /// Structure that holds the parameters for a stack
 struct StackParameters
 {
+	Int32		_shape;							///< Shape of the stack (STACK_SHAPE_WALL, STACK_SHAPE_SQUARE or STACK_SHAPE_HEX)
 	Int32		_baseCount;					///< How many items the base (lowest) row should have
 	Float		_baseLength;				///< The length of the stack (if no path spline used)
 	Int32		_rowCount;					///< How many rows to generate maximum
@@ -52,15 +88,32 @@ struct StackParameters
 	Float		_randomRot;					///< Random position
 	Float		_randomOffX;				///< Random X offset
 	Float		_randomOffZ;				///< Random Z offset
+	Int32		_settleIterations;	///< Number of iterations for pushing overlapping items apart, 0 for none
+	Float		_itemRadius;				///< Radius of an item in the plane of its row, used for settling. Set by the caller.
 	SplineObject	*_basePath;		///< Pointer to path spline
+	UInt32	_basePathDirty;			///< Dirty checksum of the path spline
+	Matrix	_basePathMg;				///< Global matrix of the path spline
+	Bool		_renderInstances;		///< Create render instances instead of clones
+	Bool		_compactItems;			///< Store items as CompactStackItem instead of full matrices
+	Int32		_gridCountX;				///< Number of stacks side by side (along X)
+	Int32		_gridCountZ;				///< Number of stacks one behind the other (along Z)
+	Float		_gridSpacingX;			///< Distance between stacks along X
+	Float		_gridSpacingZ;			///< Distance between stacks along Z
+	UInt32	_sourceDirty;				///< Dirty checksum of the stacked object(s), set by the caller
+	Int32		_variationCount;		///< Number of variations (e.g. different stacked objects) the items choose from, set by the caller
+	Float		_variationWeights[CANSTACK_MAX_VARIATIONS];	///< Relative probability of each variation
 	
 	/// Default constructor
-	StackParameters() : _baseCount(0), _baseLength(0.0), _rowCount(0), _rowHeight(0.0), _randomSeed(0), _randomRot(0.0), _randomOffX(0.0), _randomOffZ(0.0), _basePath(nullptr)
-	{ }
+	StackParameters() : _shape(STACK_SHAPE_WALL), _baseCount(0), _baseLength(0.0), _rowCount(0), _rowHeight(0.0), _randomSeed(0), _randomRot(0.0), _randomOffX(0.0), _randomOffZ(0.0), _settleIterations(0), _itemRadius(0.0), _basePath(nullptr), _basePathDirty(0), _renderInstances(false), _compactItems(false), _gridCountX(1), _gridCountZ(1), _gridSpacingX(0.0), _gridSpacingZ(0.0), _sourceDirty(0), _variationCount(1)
+	{
+		for (Int32 variationIndex = 0; variationIndex < CANSTACK_MAX_VARIATIONS; ++variationIndex)
+			_variationWeights[variationIndex] = 1.0;
+	}
 	
 	// Constructor from BaseContainer
 	StackParameters(const BaseContainer &bc, const BaseDocument &doc)
 	{
+		_shape = bc.GetInt32(STACK_SHAPE, STACK_SHAPE_WALL);
 		_baseCount = bc.GetInt32(STACK_BASE_COUNT);
 		_baseLength = bc.GetFloat(STACK_BASE_LENGTH);
 		_rowCount = bc.GetInt32(STACK_ROWS_COUNT);
@@ -69,28 +122,132 @@ struct StackParameters
 		_randomRot = bc.GetFloat(STACK_RANDOM_ROT);
 		_randomOffX = bc.GetFloat(STACK_RANDOM_OFF_X);
 		_randomOffZ = bc.GetFloat(STACK_RANDOM_OFF_Z);
-		_basePath = static_cast<SplineObject*>(bc.GetObjectLink(STACK_BASE_PATH, &doc));
+		_settleIterations = bc.GetInt32(STACK_SETTLE_ITERATIONS);
+		_itemRadius = 0.0;
+		_basePath = (_shape == STACK_SHAPE_WALL) ? static_cast<SplineObject*>(bc.GetObjectLink(STACK_BASE_PATH, &doc)) : nullptr;	// Only walls can follow a spline
+		_basePathDirty = _basePath ? _basePath->GetDirty(DIRTYFLAGS_DATA) : 0;
+		_basePathMg = _basePath ? _basePath->GetMg() : Matrix();
+		_renderInstances = bc.GetBool(STACK_RENDERINSTANCES);
+		_compactItems = bc.GetBool(STACK_COMPACT_ITEMS);
+		_gridCountX = Max(bc.GetInt32(STACK_GRID_COUNT_X, 1), (Int32)1);
+		_gridCountZ = Max(bc.GetInt32(STACK_GRID_COUNT_Z, 1), (Int32)1);
+		_gridSpacingX = bc.GetFloat(STACK_GRID_SPACING_X);
+		_gridSpacingZ = bc.GetFloat(STACK_GRID_SPACING_Z);
+		_sourceDirty = 0;
+		_variationCount = 1;
+		ParseVariationWeights(bc.GetString(STACK_VARIATION_WEIGHTS), _variationWeights);
 	}
 	
 	/// Copy constructor
-	StackParameters(const StackParameters &src) : _baseCount(src._baseCount), _baseLength(src._baseLength), _rowCount(src._rowCount), _rowHeight(src._rowHeight), _randomSeed(src._randomSeed), _randomRot(src._randomRot), _randomOffX(src._randomOffX), _randomOffZ(src._randomOffZ), _basePath(src._basePath)
+	StackParameters(const StackParameters &src) : _shape(src._shape), _baseCount(src._baseCount), _baseLength(src._baseLength), _rowCount(src._rowCount), _rowHeight(src._rowHeight), _randomSeed(src._randomSeed), _randomRot(src._randomRot), _randomOffX(src._randomOffX), _randomOffZ(src._randomOffZ), _settleIterations(src._settleIterations), _itemRadius(src._itemRadius), _basePath(src._basePath), _basePathDirty(src._basePathDirty), _basePathMg(src._basePathMg), _renderInstances(src._renderInstances), _compactItems(src._compactItems), _gridCountX(src._gridCountX), _gridCountZ(src._gridCountZ), _gridSpacingX(src._gridSpacingX), _gridSpacingZ(src._gridSpacingZ), _sourceDirty(src._sourceDirty), _variationCount(src._variationCount)
+	{
+		for (Int32 variationIndex = 0; variationIndex < CANSTACK_MAX_VARIATIONS; ++variationIndex)
+			_variationWeights[variationIndex] = src._variationWeights[variationIndex];
+	}
+	
+	/// Compares these parameters to another set of parameters and tells what kind of change it would be to switch from one to the other.
+	/// @param[in] other							The StackParameters object to compare with
+	/// @return												STACKCHANGE_NONE if both are equal, otherwise flags for the changed categories
+	STACKCHANGE Compare(const StackParameters &other) const
+	{
+		STACKCHANGE changes = STACKCHANGE_NONE;
+		
+		// Changes that affect the number of items or the objects that are generated
+		if ((_shape != other._shape) ||
+		    (_baseCount != other._baseCount) ||
+		    (_rowCount != other._rowCount) ||
+		    (_renderInstances != other._renderInstances) ||
+		    (_gridCountX != other._gridCountX) ||
+		    (_gridCountZ != other._gridCountZ) ||
+		    (_variationCount != other._variationCount))
+			changes |= STACKCHANGE_STRUCTURE;
+		
+		// With more than one variation, weights and seed decide which object is built for each item
+		if (_variationCount > 1)
+		{
+			if (_randomSeed != other._randomSeed)
+				changes |= STACKCHANGE_STRUCTURE;
+			
+			for (Int32 variationIndex = 0; variationIndex < Min(_variationCount, CANSTACK_MAX_VARIATIONS); ++variationIndex)
+			{
+				if (_variationWeights[variationIndex] != other._variationWeights[variationIndex])
+					changes |= STACKCHANGE_STRUCTURE;
+			}
+		}
+		
+		// Changes that only move the items
+		if ((_baseLength != other._baseLength) ||
+		    (_rowHeight != other._rowHeight) ||
+		    (_randomSeed != other._randomSeed) ||
+		    (_randomRot != other._randomRot) ||
+		    (_randomOffX != other._randomOffX) ||
+		    (_randomOffZ != other._randomOffZ) ||
+		    (_settleIterations != other._settleIterations) ||
+		    (_compactItems != other._compactItems) ||
+		    ((_settleIterations > 0) && (_itemRadius != other._itemRadius)) ||
+		    (_basePath != other._basePath) ||
+		    (_basePathDirty != other._basePathDirty) ||
+		    (_basePathMg != other._basePathMg) ||
+		    (_gridSpacingX != other._gridSpacingX) ||
+		    (_gridSpacingZ != other._gridSpacingZ))
+			changes |= STACKCHANGE_LAYOUT;
+		
+		// Changes of the stacked object
+		if (_sourceDirty != other._sourceDirty)
+			changes |= STACKCHANGE_SOURCE;
+		
+		return changes;
+	}
+	
+	/// Computes a hash over all parameters and the state of the inputs (path spline and stacked object).
+	/// If two fingerprints are equal, the stacks they have been computed for are equal, too.
+	/// @return												The fingerprint
+	UInt64 GetFingerprint() const;
+	
+	/// Computes a hash over all parameters that define where items are placed.
+	/// Unlike GetFingerprint(), it doesn't contain dirty checksums, so it stays the same across sessions and can be stored in files.
+	/// The shape of the path spline is not part of it, only its placement.
+	/// @return												The fingerprint
+	UInt64 GetLayoutFingerprint() const;
+	
+	/// Reads variation weights from a list of numbers, separated by spaces, commas or semicolons (e.g. "3, 1, 1").
+	/// Variations without a number in the list get a weight of 1.0, negative numbers count as 0.0.
+	/// @param[in] text								The list of weights
+	/// @param[out] weights						Array of CANSTACK_MAX_VARIATIONS weights
+	static void ParseVariationWeights(const String &text, Float *weights);
+};
+
+
+/// Structure that holds the settings for turning generated stack data into objects.
+/// Unlike StackParameters, these don't change the stack itself, only what is built from it.
+struct StackBuildSettings
+{
+	Bool		_useRenderInstances;	///< If true, only the first item is a clone, all others are render instances of it
+	Int32		_lodMode;							///< Level of detail: STACK_LOD_MODE_OFF builds all items, STACK_LOD_MODE_SHELL only the outer items, STACK_LOD_MODE_BOX a single box
+	Bool		_cullHidden;					///< If true, items that can't be seen from outside the stack are not built
+	Bool		_itemColors;					///< If true, each item gets a display color between _color1 and _color2, chosen by its random value
+	Vector	_color1;							///< Display color of items with random value 0.0
+	Vector	_color2;							///< Display color of items with random value 1.0
+	
+	/// Default constructor
+	StackBuildSettings() : _useRenderInstances(false), _lodMode(STACK_LOD_MODE_OFF), _cullHidden(false), _itemColors(false)
+	{ }
+	
+	/// Constructor
+	StackBuildSettings(Bool useRenderInstances, Int32 lodMode, Bool cullHidden = false) : _useRenderInstances(useRenderInstances), _lodMode(lodMode), _cullHidden(cullHidden), _itemColors(false)
 	{ }
 	
-	/// Checks if two StackParameters objects are equal.
-	/// @param[in] x1									The first StackParameters object
-	/// @param[in] x2									The second StackParameters object
-	/// @return												True if both are equal, otherwise false.
-	friend Bool operator == (const StackParameters& x1, const StackParameters& x2)
-	{
-		return (x1._baseCount == x2._baseCount) &&
-		       (x1._baseLength == x2._baseLength) &&
-		       (x1._rowCount == x2._rowCount) &&
-		       (x1._rowHeight == x2._rowHeight) &&
-		       (x1._randomSeed == x2._randomSeed) &&
-		       (x1._randomRot == x2._randomRot) &&
-		       (x1._randomOffX == x2._randomOffX) &&
-		       (x1._randomOffZ == x2._randomOffZ) &&
-		       (x1._basePath == x2._basePath);
+	/// Returns true if both settings build the same objects
+	Bool operator==(const StackBuildSettings &other) const
+	{
+		return (_useRenderInstances == other._useRenderInstances) && (_lodMode == other._lodMode) && (_cullHidden == other._cullHidden) &&
+		       (_itemColors == other._itemColors) && (!_itemColors || ((_color1 == other._color1) && (_color2 == other._color2)));
+	}
+	
+	/// Returns true if the settings build different objects
+	Bool operator!=(const StackBuildSettings &other) const
+	{
+		return !(*this == other);
 	}
 };
 
@@ -101,33 +258,516 @@ class CanStackGenerator
 public:
 	/// Copies parameters, initializes the stack data arrays and internal structures
 	Bool InitStack(const StackParameters &params);
+	
+	/// Sets the number of items in the base row to as many items as fit on the stack's length or path spline, without overlapping.
+	/// Call before InitStack(), the spline length is cached between calls.
+	/// @param[in,out] params					The stack parameters to modify
+	/// @param[in] itemSize						Size of an item along the stack (usually the diameter of the stacked object)
+	/// @return												True if successful, otherwise false
+	Bool FitBaseCount(StackParameters &params, Float itemSize);
 
 	/// Fills the arrays with data, according to the StackParameters passed in InitStack()
 	Bool GenerateStack();
 	
-	/// Returns
-	BaseObject *BuildStackGeometry(BaseObject *originalObject, const Matrix &mg, Bool useRenderInstances);
+	/// Builds a hierarchy of clones (or render instances) from the generated stack data.
+	/// Each variation is cloned once for its first item; with render instances, all other items of the variation are instances of that clone.
+	/// @param[in] originalObject			The object that should be stacked. If the stack has more than one variation, the next siblings of this object are the other variations.
+	/// @param[in] mg									Global matrix of the generator object
+	/// @param[in] settings						Defines which objects are built for the items
+	/// @param[in] references					Optional clones of the stacked objects, one per variation (see DetachReferences()), that are used as first item of their variation instead of cloning again. Entries may be nullptr. The function takes ownership of all of them.
+	/// @param[in] visibleCount				Number of items that are visible, counted from the first item of the first stack. All others are built, but hidden. NOTOK shows all items.
+	/// @return												A Null object with all items as children. Caller owns the pointed object.
+	BaseObject *BuildStackGeometry(BaseObject *originalObject, const Matrix &mg, const StackBuildSettings &settings, maxon::BaseArray<BaseObject*> *references = nullptr, Int visibleCount = NOTOK);
+	
+	/// Detaches the first clone of every variation from a hierarchy that has previously been built with BuildStackGeometry().
+	/// These are full clones of the stacked objects, and can be passed to the next BuildStackGeometry() call as long as the stacked objects don't change.
+	/// @param[in] result							The parent object returned by the last BuildStackGeometry() call
+	/// @param[out] references				Receives one detached clone per variation, or nullptr for variations without a clone. Box proxies don't have any. Caller owns the pointed objects.
+	/// @return												True if successful, otherwise false
+	Bool DetachReferences(BaseObject *result, maxon::BaseArray<BaseObject*> &references) const;
+	
+	/// Updates the matrices and visibility of a hierarchy that has previously been built with BuildStackGeometry(), without allocating or cloning anything.
+	/// Only works if the number of items and the build settings didn't change since the hierarchy has been built.
+	/// If the items haven't moved since the last build or update, only the items whose visibility changed are touched.
+	/// @param[in] result							The parent object returned by the last BuildStackGeometry() call
+	/// @param[in] mg									Global matrix of the generator object
+	/// @param[in] settings						The settings the hierarchy should match
+	/// @param[in] visibleCount				Number of items that are visible, counted from the first item of the first stack. NOTOK shows all items.
+	/// @return												True if all items have been updated, false if the hierarchy doesn't match the stack and has to be rebuilt
+	Bool UpdateStackGeometry(BaseObject *result, const Matrix &mg, const StackBuildSettings &settings, Int visibleCount = NOTOK);
+	
+	/// Writes the generated items to a file, so they don't have to be generated again after loading
+	/// @param[in] hf									The file to write to
+	/// @return												True if successful, otherwise false
+	Bool WriteItems(HyperFile *hf) const;
+	
+	/// Reads items that have been written with WriteItems(). The next InitStack() call uses them instead of generating the stack,
+	/// if its parameters have the same layout fingerprint.
+	/// @param[in] hf									The file to read from
+	/// @return												True if successful, otherwise false
+	Bool ReadItems(HyperFile *hf);
+	
+	/// Takes over the generated items of another generator, e.g. when a Stack object is copied.
+	/// Like items read with ReadItems(), they are used by the next InitStack() call if its parameters have the same layout fingerprint.
+	/// @param[in] src								The generator to copy from
+	/// @param[in] copyItems					If false, the items are not copied (e.g. for undo copies), and the next InitStack() call generates them again
+	/// @return												True if successful, otherwise false
+	Bool CopyFrom(const CanStackGenerator &src, Bool copyItems = true);
+	
+	/// Returns true if the items have been generated for the parameters passed in the last call to InitStack()
+	Bool IsGenerated() const
+	{
+		return _initialized && _generated;
+	}
+	
+	/// Returns the number of variations the items choose from
+	Int32 GetVariationCount() const
+	{
+		return ClampValue(_params._variationCount, (Int32)1, CANSTACK_MAX_VARIATIONS);
+	}
+	
+	/// Returns the settings used in the last call to BuildStackGeometry()
+	const StackBuildSettings &GetBuildSettings() const
+	{
+		return _buildSettings;
+	}
+	
+	/// Returns the number of visible items passed in the last call to BuildStackGeometry() or UpdateStackGeometry()
+	Int GetVisibleCount() const
+	{
+		return _visibleCount;
+	}
+	
+	/// Returns what changed in the last call to InitStack()
+	STACKCHANGE GetLastChanges() const
+	{
+		return _lastChanges;
+	}
+	
+	/// Returns the fingerprint of the parameters and inputs passed in the last successful call to InitStack().
+	/// Tools can store it and skip work on stacks whose fingerprint hasn't changed.
+	/// @return												The fingerprint, or 0 if the generator is not initialized
+	UInt64 GetFingerprint() const
+	{
+		return _initialized ? _fingerprint : 0;
+	}
+	
+	/// Returns the layout fingerprint (see StackParameters::GetLayoutFingerprint()) of the parameters passed in the last successful call to InitStack().
+	/// Unlike GetFingerprint(), it stays the same across sessions, so it can be stored in files.
+	/// @return												The layout fingerprint, or 0 if the generator is not initialized
+	UInt64 GetLayoutFingerprint() const
+	{
+		return _initialized ? _params.GetLayoutFingerprint() : 0;
+	}
+	
+	/// Writes the local matrices of all items (relative to the generator object) into an array.
+	/// Together with GetReferenceObject() this is everything an instancing output needs: One reference object and one matrix per item.
+	/// @param[in] mg									Global matrix of the generator object
+	/// @param[out] matrices					Array that will receive one matrix per item
+	/// @return												True if successful, otherwise false
+	Bool GetInstanceMatrices(const Matrix &mg, maxon::BaseArray<Matrix> &matrices) const;
+	
+	/// Finds all items whose position is within a radius around a point, e.g. for effectors or for selecting items to remove.
+	/// Uses a spatial index over the item positions, which is built on the first query after the items have changed, and kept until they change again.
+	/// @param[in] center							Center of the search, in the generator's local space
+	/// @param[in] radius							Maximum distance of an item's position from the center
+	/// @param[in] mg									Global matrix of the generator object
+	/// @param[out] itemIndices				Receives the indices of all found items, in no particular order
+	/// @return												True if successful, otherwise false
+	Bool FindItemsInRadius(const Vector &center, Float radius, const Matrix &mg, maxon::BaseArray<Int> &itemIndices);
+	
+	/// Finds the item whose position is closest to a point, e.g. for picking
+	/// @param[in] center							Point to search from, in the generator's local space
+	/// @param[in] maxRadius					Maximum distance of an item's position from the point
+	/// @param[in] mg									Global matrix of the generator object
+	/// @return												Index of the closest item, or NOTOK if there is none within maxRadius
+	Int FindNearestItem(const Vector &center, Float maxRadius, const Matrix &mg);
+	
+	/// Returns the spatial index over the item positions, building it if necessary. Its point indices are item indices.
+	/// Positions are in the same space as the item matrices, the generator's local space for straight stacks, global space for stacks on a path spline.
+	/// @return												The spatial index, or nullptr if the stack hasn't been generated or the index could not be built
+	const StackSpatialIndex *GetSpatialIndex();
+	
+	/// Returns the variation index of an item, used to choose between the stacked objects
+	/// @param[in] itemIndex					Index of the item
+	/// @return												Variation index in the range [0, variation count)
+	Int32 GetItemVariation(Int itemIndex) const
+	{
+		return _itemVariations[itemIndex];
+	}
+	
+	/// Returns the random value of an item. Unlike the random offsets and rotation, it's not used by the generator itself,
+	/// but passed to the built objects (see StackBuildSettings::_itemColors) and to instancing outputs.
+	/// @param[in] itemIndex					Index of the item
+	/// @return												Random value in the range [0.0, 1.0]
+	Float GetItemRandomValue(Int itemIndex) const
+	{
+		return _itemRandomValues[itemIndex];
+	}
+	
+	/// Returns the object that is stacked for a given input object.
+	/// @param[in] originalObject			The input object. If it's a render instance, its linked object is returned.
+	/// @return												The object to clone or instantiate, or nullptr if there is none
+	static BaseObject *GetReferenceObject(BaseObject *originalObject);
+	
+	/// Returns the number of rows in the stack
+	Int32 GetRowCount() const
+	{
+		return _rowCount;
+	}
+	
+	/// Returns the number of stacks in the grid
+	Int32 GetStackCount() const
+	{
+		return _params._gridCountX * _params._gridCountZ;
+	}
+	
+	/// Returns the number of items in each stack of the grid
+	Int GetStackItemCount() const
+	{
+		return _stackItemCount;
+	}
+	
+	/// Returns the index of the first item of a stack in the flat item array
+	/// @param[in] stackIndex					Index of the stack in the grid, stacks are ordered along X first
+	/// @return												Index of the stack's first item
+	Int GetStackOffset(Int32 stackIndex) const
+	{
+		return stackIndex * _stackItemCount;
+	}
+	
+	/// Returns the number of items in a row (a layer, in 3D shapes)
+	/// @param[in] rowIndex						Index of the row, 0 is the base row
+	/// @return												Number of items in the row
+	Int GetRowItemCount(Int32 rowIndex) const
+	{
+		return GetPyramidItemCount(_params._shape, _params._baseCount - rowIndex) - GetPyramidItemCount(_params._shape, _params._baseCount - rowIndex - 1);
+	}
+	
+	/// Returns the index of the first item of a row (a layer, in 3D shapes), relative to the first item of its stack
+	/// @param[in] rowIndex						Index of the row, 0 is the base row
+	/// @return												Index of the row's first item in its stack
+	Int GetRowOffset(Int32 rowIndex) const
+	{
+		return GetPyramidItemCount(_params._shape, _params._baseCount) - GetPyramidItemCount(_params._shape, _params._baseCount - rowIndex);
+	}
+	
+	/// Returns the number of depth rows in a row. Walls have only one, 3D shapes have one per item on the layer's edge.
+	/// @param[in] rowIndex						Index of the row, 0 is the base row
+	/// @return												Number of depth rows
+	Int32 GetDepthRowCount(Int32 rowIndex) const
+	{
+		return (_params._shape == STACK_SHAPE_WALL) ? 1 : _params._baseCount - rowIndex;
+	}
+	
+	/// Returns the number of items in a depth row
+	/// @param[in] rowIndex						Index of the row, 0 is the base row
+	/// @param[in] depthRowIndex			Index of the depth row within the row
+	/// @return												Number of items in the depth row
+	Int32 GetDepthRowItemCount(Int32 rowIndex, Int32 depthRowIndex) const
+	{
+		return (_params._shape == STACK_SHAPE_HEX) ? _params._baseCount - rowIndex - depthRowIndex : _params._baseCount - rowIndex;
+	}
+	
+	/// Returns the total number of items in all stacks
+	Int GetItemCount() const
+	{
+		return _params._compactItems ? _compactItems.GetCount() : _items.GetCount();
+	}
+	
+	/// Returns the number of items one stack will have, without initializing it
+	/// @param[in] shape							Shape of the stack
+	/// @param[in] baseCount					Number of items in the base row
+	/// @param[in] rowCount						Maximum number of rows
+	/// @return												Number of items in one stack
+	static Int CalculateStackItemCount(Int32 shape, Int32 baseCount, Int32 rowCount)
+	{
+		// Each row is 1 smaller than its predecessor, so the rows together hold
+		// the full pyramid minus the pyramid that would sit on top of the last row
+		rowCount = Max(Min(baseCount, rowCount), (Int32)0);
+		return GetPyramidItemCount(shape, baseCount) - GetPyramidItemCount(shape, baseCount - rowCount);
+	}
+	
+	/// Returns the number of items all stacks of the grid will have, without initializing them
+	/// @param[in] params							The stack parameters
+	/// @return												Total number of items
+	static Int CalculateItemCount(const StackParameters &params)
+	{
+		return CalculateStackItemCount(params._shape, params._baseCount, params._rowCount) * params._gridCountX * params._gridCountZ;
+	}
+	
+	/// Returns the number of layers that have to rest on an item of a 3D shape to close all gaps above it, see IsItemHidden()
+	/// @param[in] shape							Shape of the stack
+	/// @return												Number of layers
+	static Int32 GetCoveringLayerCount(Int32 shape)
+	{
+		return (shape == STACK_SHAPE_HEX) ? 3 : 2;
+	}
+	
+	/// Tells if an item is completely covered by its neighbours, so it can't be seen from outside the stack.
+	/// The test is purely analytic, it only looks at the item's position in the stack layout: In 3D shapes, an item is hidden
+	/// if it's not on the edge of its layer and enough layers rest on it to close all gaps above it. The layer directly above
+	/// only covers it partly, as it can still be seen through the gaps of that layer. Square layers alternate between two
+	/// positions, so the second layer above closes the gaps. Triangular layers are stacked in three positions (ABC), so a gap
+	/// through a layer is only closed by the third layer above it.
+	/// Items of a wall are only one item deep and visible from the front and from the back, so none of them is hidden.
+	/// @param[in] rowIndex						Index of the row (layer), 0 is the base row
+	/// @param[in] depthRowIndex			Index of the depth row within the row
+	/// @param[in] indexInDepthRow		Index of the item in its depth row
+	/// @return												True if the item is hidden
+	Bool IsItemHidden(Int32 rowIndex, Int32 depthRowIndex, Int32 indexInDepthRow) const
+	{
+		if (_params._shape == STACK_SHAPE_WALL || rowIndex >= _rowCount - GetCoveringLayerCount(_params._shape))
+			return false;
+		
+		return (depthRowIndex > 0) && (depthRowIndex < GetDepthRowCount(rowIndex) - 1) && (indexInDepthRow > 0) && (indexInDepthRow < GetDepthRowItemCount(rowIndex, depthRowIndex) - 1);
+	}
+	
+	/// Returns the matrix of an item relative to the generator object
+	/// @param[in] itemIndex					Index of the item in the flat item array
+	/// @param[in] invertedMg					Inverted global matrix of the generator object (only used if a path spline is used, as items on splines are generated in global space)
+	/// @return												The item's local matrix
+	Matrix GetItemMatrix(Int itemIndex, const Matrix &invertedMg) const
+	{
+		if (_params._basePath)
+			return invertedMg * GetStoredMatrix(itemIndex);		// Transform matrix from global to local generator space
+		return GetStoredMatrix(itemIndex);									// Items of straight stacks are already in local space
+	}
 	
 	// Default constructor
-	CanStackGenerator() : _initialized(false)
+	CanStackGenerator() : _rowCount(0), _stackItemCount(0), _lastChanges(STACKCHANGE_STRUCTURE), _fingerprint(0), _spatialIndexFingerprint(0), _visibleCount(NOTOK), _restoredFingerprint(0), _restored(false), _generated(false), _initialized(false)
 	{ }
 	
 private:
-	/// Resizes the internal stack arrays
-	Bool ResizeStack(Int32 baseCount, Int32 rowCount);
+	/// Resizes the internal stack array, according to the current _params
+	Bool ResizeStack();
+	
+	/// Expands a compact item to a full matrix, in the space the item has been generated in
+	/// @param[in] item								The compact item
+	/// @return												Same as MatrixRotY(item.heading), with the item position as offset
+	static Matrix ExpandCompactItem(const CompactStackItem &item)
+	{
+		Float headingSin = Sin((Float)item.heading);
+		Float headingCos = Cos((Float)item.heading);
+		return Matrix(Vector(item.posX, item.posY, item.posZ), Vector(headingCos, 0.0, -headingSin), Vector(0.0, 1.0, 0.0), Vector(headingSin, 0.0, headingCos));
+	}
+	
+	/// Returns the matrix of an item in the space the items are stored in: Global space for stacks on a path spline, otherwise local generator space.
+	/// Compact items are expanded on the fly.
+	/// @param[in] itemIndex					Index of the item in the flat item array
+	/// @return												The item's matrix
+	Matrix GetStoredMatrix(Int itemIndex) const
+	{
+		if (!_params._compactItems)
+			return _items[itemIndex].mg;
+		if (_params._basePath)
+			return _params._basePathMg * ExpandCompactItem(_compactItems[itemIndex]);
+		return ExpandCompactItem(_compactItems[itemIndex]);
+	}
+	
+	/// Returns the position of an item in the space the items are stored in, see GetStoredMatrix(). Doesn't need to expand compact items.
+	/// @param[in] itemIndex					Index of the item in the flat item array
+	/// @return												The item's position
+	Vector GetStoredPosition(Int itemIndex) const
+	{
+		if (!_params._compactItems)
+			return _items[itemIndex].mg.off;
+		
+		const CompactStackItem &item = _compactItems[itemIndex];
+		if (_params._basePath)
+			return _params._basePathMg * Vector(item.posX, item.posY, item.posZ);
+		return Vector(item.posX, item.posY, item.posZ);
+	}
+	
+	/// Pushes items apart that overlap with neighbours in the same row, in _params._settleIterations iterations.
+	/// Each iteration moves all items at once by half of their overlap with each neighbour (Jacobi style), so the result
+	/// doesn't depend on the order or the number of threads the items are processed on.
+	/// @return												True if successful, otherwise false
+	Bool SettleItems();
+	
+	/// Fills the variation index and random value of all items. These only depend on the item index, the seed and the variation count, not on the layout.
+	/// @return												True if successful, otherwise false
+	Bool GenerateAttributes();
+	
+	/// Fills a range of the item array. Only writes items in the range, so it can be called from multiple threads for different ranges.
+	/// @param[in] start							Index of the first item to generate
+	/// @param[in] end								Index after the last item to generate
+	/// @param[in] distance						Distance between items (if no path spline used)
+	/// @param[in] relDistance				Relative distance between items on the path spline
+	/// @param[in] splineMg						Global matrix of the path spline
+	/// @return												True if successful, otherwise false
+	Bool GenerateItems(Int start, Int end, Float distance, Float relDistance, const Matrix &splineMg);
+	
+	/// Fills a range of the item array for a stack without path spline. Works on blocks of items, one array per component,
+	/// and only builds a heading rotation instead of a full HPB matrix.
+	/// @param[in] start							Index of the first item to generate
+	/// @param[in] end								Index after the last item to generate
+	/// @param[in] distance						Distance between items
+	/// @return												True if successful, otherwise false
+	Bool GenerateStraightItems(Int start, Int end, Float distance);
+	
+	/// Finds the stack and row an item belongs to
+	/// @param[in] index							Index of the item in the flat item array
+	/// @param[out] stackIndex				Index of the item's stack
+	/// @param[out] rowIndex					Index of the item's row
+	/// @param[out] indexInRow				Index of the item in its row
+	void FindItem(Int index, Int32 &stackIndex, Int32 &rowIndex, Int &indexInRow) const;
+	
+	/// Returns the offset of a stack from the first stack of the grid
+	/// @param[in] stackIndex					Index of the stack in the grid
+	/// @return												Offset in the space the items are generated in
+	Vector GetGridOffset(Int32 stackIndex) const
+	{
+		return Vector(_params._gridSpacingX * (stackIndex % _params._gridCountX), 0.0, _params._gridSpacingZ * (stackIndex / _params._gridCountX));
+	}
+	
+	/// Returns the sum of all integers from 1 to n
+	static Int GaussSum(Int n)
+	{
+		return n * (n + 1) / 2;
+	}
+	
+	/// Returns the number of items in a complete pyramid of a shape
+	/// @param[in] shape							Shape of the stack
+	/// @param[in] n									Number of items in the base row
+	/// @return												Sum of all integers (walls), squares (square pyramids) or triangular numbers (hex pyramids) from 1 to n
+	static Int GetPyramidItemCount(Int32 shape, Int n)
+	{
+		if (n <= 0)
+			return 0;
+		
+		switch (shape)
+		{
+			case STACK_SHAPE_SQUARE:
+				return n * (n + 1) * (2 * n + 1) / 6;
+				
+			case STACK_SHAPE_HEX:
+				return n * (n + 1) * (n + 2) / 6;
+		}
+		
+		return GaussSum(n);
+	}
+	
+	/// Returns the size of the smallest complete pyramid that holds a number of items, by inverting GetPyramidItemCount()
+	/// @param[in] shape							Shape of the stack
+	/// @param[in] count							Number of items
+	/// @return												Smallest n with GetPyramidItemCount(shape, n) >= count
+	static Int FindPyramidSize(Int32 shape, Int count)
+	{
+		if (count <= 0)
+			return 0;
+		
+		// Closed-form estimate: Walls hold n(n+1)/2 items, square pyramids about n^3/3, hex pyramids about n^3/6
+		Float estimate;
+		switch (shape)
+		{
+			case STACK_SHAPE_SQUARE:
+				estimate = Pow((Float)count * 3.0, 1.0 / 3.0);
+				break;
+				
+			case STACK_SHAPE_HEX:
+				estimate = Pow((Float)count * 6.0, 1.0 / 3.0);
+				break;
+				
+			default:
+				estimate = (Sqrt((Float)count * 8.0 + 1.0) - 1.0) * 0.5;
+				break;
+		}
+		
+		// The estimate is at most 2 too large (and a little more for rounding), so step up to the exact size from just below it
+		Int n = Max((Int)estimate - 3, (Int)0);
+		while (GetPyramidItemCount(shape, n) < count)
+			n++;
+		
+		return n;
+	}
+	
+	/// Splits the index of an item in its row (layer) into depth row and index in depth row
+	/// @param[in] rowIndex						Index of the row, 0 is the base row
+	/// @param[in] indexInRow					Index of the item in its row
+	/// @param[out] depthRowIndex			Index of the depth row
+	/// @param[out] indexInDepthRow		Index of the item in its depth row
+	void SplitRowIndex(Int32 rowIndex, Int indexInRow, Int32 &depthRowIndex, Int32 &indexInDepthRow) const;
+	
+	/// Tells if an item is visible when only a part of the stack is shown
+	/// @param[in] itemIndex					Index of the item
+	/// @param[in] visibleCount				Number of visible items, NOTOK for all
+	/// @return												True if the item is visible
+	static Bool IsItemVisible(Int itemIndex, Int visibleCount)
+	{
+		return (visibleCount == NOTOK) || (itemIndex < visibleCount);
+	}
+	
+	/// Fills _builtItems with the indices of all items that are built with the given settings
+	/// @param[in] settings						Level of detail (STACK_LOD_MODE_OFF or STACK_LOD_MODE_SHELL) and culling options
+	/// @return												True if successful, otherwise false
+	Bool CollectBuiltItems(const StackBuildSettings &settings);
+	
+	/// Builds a single box that encloses all items, as a cheap stand-in for the whole stack
+	/// @param[in] objectsToClone			The objects that are stacked (one per variation), used for their bounding boxes
+	/// @param[in] mg									Global matrix of the generator object
+	/// @return												The box object, or nullptr if it could not be allocated. Caller owns the pointed object.
+	BaseObject *BuildStackProxy(const maxon::BaseArray<BaseObject*> &objectsToClone, const Matrix &mg) const;
+	
+	/// Samples of the path spline. Only resampled when the spline changes.
+	SplineSampleCache _splineSamples;
+	
+	/// This array will hold all the generated stack data. Empty if the items are compact.
+	StackItemArray _items;
+	
+	/// Generated stack data in compact form, if _params._compactItems is set. Otherwise empty.
+	CompactStackItemArray _compactItems;
+	
+	/// Spatial index over the positions of _items, built on demand
+	StackSpatialIndex _spatialIndex;
+	
+	/// Value of _fingerprint when _spatialIndex has been built, 0 if it hasn't been built
+	UInt64 _spatialIndexFingerprint;
+	
+	/// Variation index of every item, in the same order as _items
+	maxon::BaseArray<Int32> _itemVariations;
 	
-	/// SplineLengthData object required when using a spline as base path
-	/// Will be allocated only when needed, and freed automatically
-	AutoFree<SplineLengthData> _splineLengthData;
+	/// Random value of every item, in the same order as _items
+	maxon::BaseArray<Float> _itemRandomValues;
 	
-	/// This array will hold all the generated stack data
-	StackRowArray _array;
+	/// Number of rows in the stack (baseCount clamped by rowCount)
+	Int32 _rowCount;
+	
+	/// Number of items in each stack of the grid
+	Int _stackItemCount;
 	
 	/// The parameters for the stack
 	StackParameters _params;
 	
-	/// Random number generator
-	Random _random;
+	/// What changed in the last call to InitStack()
+	STACKCHANGE _lastChanges;
+	
+	/// Fingerprint of _params
+	UInt64 _fingerprint;
+	
+	/// Settings used in the last call to BuildStackGeometry()
+	StackBuildSettings _buildSettings;
+	
+	/// Indices of the items that have been built in the last call to BuildStackGeometry(), in the order of the built objects
+	maxon::BaseArray<Int> _builtItems;
+	
+	/// Global matrix of the generator object in the last call to BuildStackGeometry() or UpdateStackGeometry()
+	Matrix _builtMg;
+	
+	/// Number of visible items in the last call to BuildStackGeometry() or UpdateStackGeometry()
+	Int _visibleCount;
+	
+	/// Per variation: Built index of the first clone in the last built hierarchy, NOTOK if the variation has no clone
+	maxon::BaseArray<Int> _builtReferences;
+	
+	/// Layout fingerprint of the items read with ReadItems()
+	UInt64 _restoredFingerprint;
+	
+	/// Set to true if _items (or _compactItems) have been read with ReadItems() or copied with CopyFrom(), and not yet been validated by InitStack()
+	Bool _restored;
+	
+	/// Set to true after GenerateStack() has filled the array for the current parameters
+	Bool _generated;
 	
 	/// Set to true after successful initialization
 	Bool _initialized;
@@ -0,0 +1,639 @@
+#include "canstackselftest.h"
+#include "canstackgenerator.h"
+#include "stackrandom.h"
+
+
+/// Maximum difference between values that are computed in double precision in the same way
+static const Float CANSTACK_SELFTEST_EPSILON = 1e-9;
+
+/// Maximum difference between positions on the test spline and their exact values. Spline samples are interpolated, so they are not exact.
+static const Float CANSTACK_SELFTEST_SPLINE_EPSILON = 1e-3;
+
+/// Maximum difference between compact and full items, relative to the size of the values. 32 bit floats have a 24 bit mantissa.
+static const Float CANSTACK_SELFTEST_COMPACT_EPSILON = 1e-6;
+
+/// Length of the linear test spline
+static const Float CANSTACK_SELFTEST_PATH_LENGTH = 1000.0;
+
+/// Base counts of the scaling passes
+static const Int32 g_selfTestScalingBaseCounts[] = { 1000, 3000, 10000 };
+
+/// Maximum number of rows of the scaling passes, same as in the benchmark
+static const Int32 CANSTACK_SELFTEST_SCALING_ROWS = 100;
+
+/// Number of runs of each scaling pass, the fastest run counts
+static const Int32 CANSTACK_SELFTEST_SCALING_RUNS = 5;
+
+/// The scaling check fails if the time per item of the largest pass is more than this factor of the time per item of the smallest pass.
+/// Generation is linear in the item count, so only a superlinear regression exceeds it, not timing noise.
+static const Float CANSTACK_SELFTEST_MAX_SCALING = 4.0;
+
+
+/// Position and heading of one item, as generated for a fixed seed
+struct StackGoldenItem
+{
+	Int			_itemIndex;		///< Index of the item
+	Float		_posX;				///< X position
+	Float		_posY;				///< Y position
+	Float		_posZ;				///< Z position
+	Float		_heading;			///< Rotation around the Y axis
+};
+
+
+/// Golden items of a straight wall: baseCount 5, 3 rows, length 100, row height 10, seed 12345 (12 items)
+static const StackGoldenItem g_goldenWallItems[] =
+{
+	{ 0, -0.37470015577854321, 0.0, 0.67955925726016853, 0.035385524757811801 },
+	{ 6, -0.41838123207168509, 10.0, 32.083857100501653, -0.11666217808900037 },
+	{ 11, -1.0857853709883121, 20.0, 58.679572774899569, 0.017393372676796592 }
+};
+
+/// Golden items of a grid of two triangular pyramids: baseCount 4, 3 rows, length 80, row height 8, seed 777, spacing X 150 (38 items)
+static const StackGoldenItem g_goldenHexItems[] =
+{
+	{ 0, -0.62282615721253887, 0.0, -2.3286712504802463, -0.0088922625812189338 },
+	{ 12, 7.5197386285136503, 8.0, 47.916195823308065, 0.035160807195468859 },
+	{ 18, 29.296653912742638, 16.0, 32.560712109736002, 0.00089342460486971917 },
+	{ 30, 154.79304325833752, 8.0, 27.435121807766727, 0.055580365824320042 }
+};
+
+
+/// Returns stack parameters with random rotation and offsets, so that all code paths are used
+static StackParameters GetTestParameters(Int32 shape, Int32 baseCount, Int32 rowCount, Float baseLength, Float rowHeight, UInt32 seed)
+{
+	StackParameters params;
+	params._shape = shape;
+	params._baseCount = baseCount;
+	params._baseLength = baseLength;
+	params._rowCount = rowCount;
+	params._rowHeight = rowHeight;
+	params._randomSeed = seed;
+	params._randomRot = 0.3;
+	params._randomOffX = 2.0;
+	params._randomOffZ = 3.0;
+	return params;
+}
+
+
+/// Returns the parameters of a wall on the linear test spline (see CreateTestPath()), in a grid of two stacks
+static StackParameters GetSplineTestParameters(SplineObject *path, Int32 baseCount, Int32 rowCount, Bool randomize)
+{
+	StackParameters params = GetTestParameters(STACK_SHAPE_WALL, baseCount, rowCount, 0.0, 10.0, 12345);
+	if (!randomize)
+	{
+		params._randomRot = 0.0;
+		params._randomOffX = 0.0;
+		params._randomOffZ = 0.0;
+	}
+	params._basePath = path;
+	params._basePathMg = MatrixMove(Vector(100.0, 0.0, 50.0)) * MatrixRotY(0.5);
+	params._gridCountX = 2;
+	params._gridSpacingX = 30.0;
+	return params;
+}
+
+
+/// Creates a straight spline along the Z axis, so positions on it can be computed exactly
+static SplineObject *CreateTestPath()
+{
+	SplineObject *spline = SplineObject::Alloc(2, SPLINETYPE_LINEAR);
+	if (!spline)
+		return nullptr;
+
+	Vector *points = spline->GetPointW();
+	points[0] = Vector(0.0, 0.0, 0.0);
+	points[1] = Vector(0.0, 0.0, CANSTACK_SELFTEST_PATH_LENGTH);
+	spline->Message(MSG_UPDATE);
+
+	return spline;
+}
+
+
+/// Initializes a generator and generates its items
+static Bool GenerateTestStack(CanStackGenerator &generator, const StackParameters &params)
+{
+	return generator.InitStack(params) && generator.GenerateStack();
+}
+
+
+/// Tells if two matrices are equal within a tolerance, separately for the offset and the axes
+static Bool MatricesMatch(const Matrix &a, const Matrix &b, Float offsetEpsilon, Float axisEpsilon)
+{
+	Vector offDelta = a.off - b.off;
+	Vector v1Delta = a.v1 - b.v1;
+	Vector v2Delta = a.v2 - b.v2;
+	Vector v3Delta = a.v3 - b.v3;
+	return (Max(Max(Abs(offDelta.x), Abs(offDelta.y)), Abs(offDelta.z)) <= offsetEpsilon) &&
+	       (Max(Max(Abs(v1Delta.x), Abs(v1Delta.y)), Abs(v1Delta.z)) <= axisEpsilon) &&
+	       (Max(Max(Abs(v2Delta.x), Abs(v2Delta.y)), Abs(v2Delta.z)) <= axisEpsilon) &&
+	       (Max(Max(Abs(v3Delta.x), Abs(v3Delta.y)), Abs(v3Delta.z)) <= axisEpsilon);
+}
+
+
+/// Describes an item that doesn't match its expected matrix
+static String DescribeMismatch(Int itemIndex, const Matrix &itemMatrix, const Matrix &expected)
+{
+	return "Item " + String::IntToString(itemIndex) + " is at " + String::VectorToString(itemMatrix.off) + ", expected " + String::VectorToString(expected.off);
+}
+
+
+/// Computes the matrices of all items of a straight stack one by one, in the most simple way.
+/// This is the serial reference for the multithreaded, block based kernel of the generator.
+static Bool ComputeReferenceItems(const CanStackGenerator &generator, const StackParameters &params, maxon::BaseArray<Matrix> &matrices)
+{
+	if (!matrices.Resize(generator.GetItemCount()))
+		return false;
+
+	// Spacing of depth rows and shift of layers, relative to the item distance
+	Float distance = params._baseLength / (Float)params._baseCount;
+	Float depthRowStepX = 0.0;
+	Float depthRowShiftZ = 0.0;
+	Float layerShiftX = 0.0;
+	if (params._shape == STACK_SHAPE_SQUARE)
+	{
+		depthRowStepX = 1.0;
+		layerShiftX = 0.5;
+	}
+	else if (params._shape == STACK_SHAPE_HEX)
+	{
+		depthRowStepX = Sqrt(3.0) * 0.5;
+		depthRowShiftZ = 0.5;
+		layerShiftX = Sqrt(3.0) / 6.0;
+	}
+
+	Int itemIndex = 0;
+	for (Int32 stackIndex = 0; stackIndex < generator.GetStackCount(); ++stackIndex)
+	{
+		Vector gridOffset(params._gridSpacingX * (stackIndex % params._gridCountX), 0.0, params._gridSpacingZ * (stackIndex / params._gridCountX));
+		for (Int32 rowIndex = 0; rowIndex < generator.GetRowCount(); ++rowIndex)
+		{
+			for (Int32 depthRowIndex = 0; depthRowIndex < generator.GetDepthRowCount(rowIndex); ++depthRowIndex)
+			{
+				for (Int32 indexInDepthRow = 0; indexInDepthRow < generator.GetDepthRowItemCount(rowIndex, depthRowIndex); ++indexInDepthRow, ++itemIndex)
+				{
+					if (itemIndex >= matrices.GetCount())
+						return false;
+
+					Vector position(distance * (depthRowStepX * depthRowIndex + layerShiftX * rowIndex) + gridOffset.x,
+					                params._rowHeight * rowIndex,
+					                distance * indexInDepthRow + distance * (depthRowShiftZ * depthRowIndex + rowIndex * 0.5) + gridOffset.z);
+					position.x += StackRandom11(params._randomSeed, itemIndex, STACKRANDOM_OFFX) * params._randomOffX;
+					position.z += StackRandom11(params._randomSeed, itemIndex, STACKRANDOM_OFFZ) * params._randomOffZ;
+
+					matrices[itemIndex] = MatrixRotY(StackRandom11(params._randomSeed, itemIndex, STACKRANDOM_ROT) * params._randomRot);
+					matrices[itemIndex].off = position;
+				}
+			}
+		}
+	}
+
+	return itemIndex == matrices.GetCount();
+}
+
+
+/// Checks that the number of rows is clamped to the base count, and that the rows fill each stack exactly
+static Bool CheckRowClamp(SplineObject *, String &details)
+{
+	// Number of items with 2 rows, and with 10 rows (clamped to 4), for walls, square and triangular pyramids with 4 base items
+	const Int expectedCounts[3][2] = { { 7, 10 }, { 25, 30 }, { 16, 20 } };
+	const Int32 shapes[3] = { STACK_SHAPE_WALL, STACK_SHAPE_SQUARE, STACK_SHAPE_HEX };
+
+	for (Int32 shapeIndex = 0; shapeIndex < 3; ++shapeIndex)
+	{
+		for (Int32 pass = 0; pass < 2; ++pass)
+		{
+			StackParameters params = GetTestParameters(shapes[shapeIndex], 4, pass ? 10 : 2, 40.0, 10.0, 1);
+			Int32 expectedRows = pass ? 4 : 2;
+			Int expectedCount = expectedCounts[shapeIndex][pass];
+			String passName = "Shape " + String::IntToString(shapes[shapeIndex]) + " with " + String::IntToString(params._rowCount) + " rows: ";
+
+			if (CanStackGenerator::CalculateItemCount(params) != expectedCount)
+			{
+				details = passName + "CalculateItemCount() returned " + String::IntToString(CanStackGenerator::CalculateItemCount(params)) + ", expected " + String::IntToString(expectedCount);
+				return false;
+			}
+
+			CanStackGenerator generator;
+			if (!GenerateTestStack(generator, params))
+			{
+				details = passName + "Generation failed";
+				return false;
+			}
+
+			if (generator.GetRowCount() != expectedRows || generator.GetItemCount() != expectedCount)
+			{
+				details = passName + String::IntToString(generator.GetRowCount()) + " rows with " + String::IntToString(generator.GetItemCount()) + " items, expected " + String::IntToString(expectedRows) + " rows with " + String::IntToString(expectedCount) + " items";
+				return false;
+			}
+
+			// Rows follow each other without gaps, and every item sits at the height of its row
+			Int rowEnd = 0;
+			for (Int32 rowIndex = 0; rowIndex < generator.GetRowCount(); ++rowIndex)
+			{
+				if (generator.GetRowOffset(rowIndex) != rowEnd || generator.GetRowItemCount(rowIndex) < 1)
+				{
+					details = passName + "Row " + String::IntToString(rowIndex) + " doesn't follow the previous row";
+					return false;
+				}
+
+				for (Int indexInRow = 0; indexInRow < generator.GetRowItemCount(rowIndex); ++indexInRow)
+				{
+					Float height = generator.GetItemMatrix(rowEnd + indexInRow, Matrix()).off.y;
+					if (Abs(height - params._rowHeight * rowIndex) > CANSTACK_SELFTEST_EPSILON)
+					{
+						details = passName + "Item " + String::IntToString(rowEnd + indexInRow) + " is not at the height of row " + String::IntToString(rowIndex);
+						return false;
+					}
+				}
+
+				rowEnd += generator.GetRowItemCount(rowIndex);
+			}
+
+			if (rowEnd != generator.GetStackItemCount())
+			{
+				details = passName + "Rows hold " + String::IntToString(rowEnd) + " items, the stack has " + String::IntToString(generator.GetStackItemCount());
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+/// Compares the items of a straight stack to golden data
+static Bool CheckGoldenItems(const StackParameters &params, Int expectedCount, const StackGoldenItem *goldenItems, Int goldenCount, String &details)
+{
+	CanStackGenerator generator;
+	if (!GenerateTestStack(generator, params))
+	{
+		details = "Generation failed";
+		return false;
+	}
+
+	if (generator.GetItemCount() != expectedCount)
+	{
+		details = String::IntToString(generator.GetItemCount()) + " items, expected " + String::IntToString(expectedCount);
+		return false;
+	}
+
+	for (Int goldenIndex = 0; goldenIndex < goldenCount; ++goldenIndex)
+	{
+		const StackGoldenItem &golden = goldenItems[goldenIndex];
+		Matrix expected = MatrixRotY(golden._heading);
+		expected.off = Vector(golden._posX, golden._posY, golden._posZ);
+
+		Matrix itemMatrix = generator.GetItemMatrix(golden._itemIndex, Matrix());
+		if (!MatricesMatch(itemMatrix, expected, CANSTACK_SELFTEST_EPSILON, CANSTACK_SELFTEST_EPSILON))
+		{
+			details = DescribeMismatch(golden._itemIndex, itemMatrix, expected);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/// Checks the items of straight stacks against golden data for fixed seeds
+static Bool CheckGoldenData(SplineObject *, String &details)
+{
+	StackParameters wallParams = GetTestParameters(STACK_SHAPE_WALL, 5, 3, 100.0, 10.0, 12345);
+	if (!CheckGoldenItems(wallParams, 12, g_goldenWallItems, sizeof(g_goldenWallItems) / sizeof(g_goldenWallItems[0]), details))
+	{
+		details = "Wall: " + details;
+		return false;
+	}
+
+	StackParameters hexParams = GetTestParameters(STACK_SHAPE_HEX, 4, 3, 80.0, 8.0, 777);
+	hexParams._gridCountX = 2;
+	hexParams._gridSpacingX = 150.0;
+	if (!CheckGoldenItems(hexParams, 38, g_goldenHexItems, sizeof(g_goldenHexItems) / sizeof(g_goldenHexItems[0]), details))
+	{
+		details = "Triangular pyramid: " + details;
+		return false;
+	}
+
+	return true;
+}
+
+
+/// Checks the items on a straight spline against their exact positions: first a small stack without random values,
+/// then a large one with random values that is generated on several threads
+static Bool CheckSplineOffsets(SplineObject *path, String &details)
+{
+	// The test spline runs along Z, items are offset to the -X side and along Z
+	Vector tangent(0.0, 0.0, 1.0);
+	Vector crossTangent = Cross(tangent, Vector(0.0, 1.0, 0.0));
+	Matrix generatorMg = MatrixMove(Vector(-20.0, 5.0, 0.0));
+	Matrix invertedGeneratorMg = ~generatorMg;
+
+	for (Int32 pass = 0; pass < 2; ++pass)
+	{
+		StackParameters params = pass ? GetSplineTestParameters(path, 2000, 10, true) : GetSplineTestParameters(path, 11, 4, false);
+
+		CanStackGenerator generator;
+		if (!GenerateTestStack(generator, params))
+		{
+			details = "Generation failed";
+			return false;
+		}
+
+		// Items sit on multiples of half the relative distance, see CanStackGenerator::GenerateItems()
+		Float relDistance = 1.0 / (Float)(params._baseCount - 1);
+		Int itemIndex = 0;
+		for (Int32 stackIndex = 0; stackIndex < generator.GetStackCount(); ++stackIndex)
+		{
+			Vector gridOffset(params._gridSpacingX * (stackIndex % params._gridCountX), 0.0, params._gridSpacingZ * (stackIndex / params._gridCountX));
+			for (Int32 rowIndex = 0; rowIndex < generator.GetRowCount(); ++rowIndex)
+			{
+				for (Int indexInRow = 0; indexInRow < generator.GetRowItemCount(rowIndex); ++indexInRow, ++itemIndex)
+				{
+					Vector position(0.0, params._rowHeight * rowIndex, CANSTACK_SELFTEST_PATH_LENGTH * ((relDistance * indexInRow) + (relDistance * 0.5 * rowIndex)));
+					position += crossTangent * StackRandom11(params._randomSeed, itemIndex, STACKRANDOM_OFFX) * params._randomOffX;
+					position += tangent * StackRandom11(params._randomSeed, itemIndex, STACKRANDOM_OFFZ) * params._randomOffZ;
+					position += gridOffset;
+
+					Matrix expected = MatrixRotY(StackRandom11(params._randomSeed, itemIndex, STACKRANDOM_ROT) * params._randomRot);
+					expected.off = position;
+					expected = invertedGeneratorMg * params._basePathMg * expected;
+
+					Matrix itemMatrix = generator.GetItemMatrix(itemIndex, invertedGeneratorMg);
+					if (!MatricesMatch(itemMatrix, expected, CANSTACK_SELFTEST_SPLINE_EPSILON, CANSTACK_SELFTEST_EPSILON))
+					{
+						details = DescribeMismatch(itemIndex, itemMatrix, expected);
+						return false;
+					}
+				}
+			}
+		}
+
+		if (itemIndex != generator.GetItemCount())
+		{
+			details = String::IntToString(generator.GetItemCount()) + " items, expected " + String::IntToString(itemIndex);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/// Compares large straight stacks of all shapes, generated on several threads in blocks, to the serial reference
+static Bool CheckParallelKernel(SplineObject *, String &details)
+{
+	StackParameters paramSets[3] =
+	{
+		GetTestParameters(STACK_SHAPE_WALL, 3000, 20, 30000.0, 10.0, 12345),
+		GetTestParameters(STACK_SHAPE_SQUARE, 40, 40, 400.0, 10.0, 42),
+		GetTestParameters(STACK_SHAPE_HEX, 60, 60, 600.0, 10.0, 4711)
+	};
+	paramSets[1]._gridCountX = 2;
+	paramSets[1]._gridSpacingX = 500.0;
+	paramSets[2]._gridCountZ = 2;
+	paramSets[2]._gridSpacingZ = 700.0;
+
+	for (Int32 setIndex = 0; setIndex < 3; ++setIndex)
+	{
+		const StackParameters &params = paramSets[setIndex];
+		String setName = "Shape " + String::IntToString(params._shape) + ": ";
+
+		CanStackGenerator generator;
+		maxon::BaseArray<Matrix> matrices;
+		maxon::BaseArray<Matrix> referenceMatrices;
+		if (!GenerateTestStack(generator, params) || !generator.GetInstanceMatrices(Matrix(), matrices) || !ComputeReferenceItems(generator, params, referenceMatrices))
+		{
+			details = setName + "Generation failed";
+			return false;
+		}
+
+		for (Int itemIndex = 0; itemIndex < matrices.GetCount(); ++itemIndex)
+		{
+			if (!MatricesMatch(matrices[itemIndex], referenceMatrices[itemIndex], CANSTACK_SELFTEST_EPSILON, CANSTACK_SELFTEST_EPSILON))
+			{
+				details = setName + DescribeMismatch(itemIndex, matrices[itemIndex], referenceMatrices[itemIndex]);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+/// Compares compact to full item storage, for a straight stack and a stack on a spline. Compact items must be the same every time they are generated.
+static Bool CheckCompactStorage(SplineObject *path, String &details)
+{
+	for (Int32 pass = 0; pass < 2; ++pass)
+	{
+		StackParameters params = pass ? GetSplineTestParameters(path, 2000, 10, true) : GetTestParameters(STACK_SHAPE_HEX, 60, 60, 600.0, 10.0, 4711);
+		StackParameters compactParams = params;
+		compactParams._compactItems = true;
+		String passName = pass ? "Spline: " : "Straight: ";
+
+		CanStackGenerator fullGenerator;
+		CanStackGenerator compactGenerator;
+		CanStackGenerator repeatedGenerator;
+		maxon::BaseArray<Matrix> fullMatrices;
+		maxon::BaseArray<Matrix> compactMatrices;
+		maxon::BaseArray<Matrix> repeatedMatrices;
+		if (!GenerateTestStack(fullGenerator, params) || !GenerateTestStack(compactGenerator, compactParams) || !GenerateTestStack(repeatedGenerator, compactParams) ||
+		    !fullGenerator.GetInstanceMatrices(Matrix(), fullMatrices) || !compactGenerator.GetInstanceMatrices(Matrix(), compactMatrices) || !repeatedGenerator.GetInstanceMatrices(Matrix(), repeatedMatrices))
+		{
+			details = passName + "Generation failed";
+			return false;
+		}
+
+		if (compactMatrices.GetCount() != fullMatrices.GetCount())
+		{
+			details = passName + String::IntToString(compactMatrices.GetCount()) + " compact items, expected " + String::IntToString(fullMatrices.GetCount());
+			return false;
+		}
+
+		for (Int itemIndex = 0; itemIndex < fullMatrices.GetCount(); ++itemIndex)
+		{
+			// Compact positions of spline items are relative to the spline, so their precision depends on the distance to the spline's origin, too
+			Float scale = 1.0 + fullMatrices[itemIndex].off.GetLength() + params._basePathMg.off.GetLength();
+			if (!MatricesMatch(compactMatrices[itemIndex], fullMatrices[itemIndex], CANSTACK_SELFTEST_COMPACT_EPSILON * scale, CANSTACK_SELFTEST_COMPACT_EPSILON))
+			{
+				details = passName + DescribeMismatch(itemIndex, compactMatrices[itemIndex], fullMatrices[itemIndex]);
+				return false;
+			}
+
+			if (compactMatrices[itemIndex] != repeatedMatrices[itemIndex])
+			{
+				details = passName + "Item " + String::IntToString(itemIndex) + " is different when generated again";
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+/// One expected result of IsItemHidden()
+struct StackHiddenItemCase
+{
+	Int32		_shape;						///< Shape of the stack
+	Int32		_rowIndex;				///< Row (layer) of the item
+	Int32		_depthRowIndex;		///< Depth row of the item
+	Int32		_indexInDepthRow;	///< Index of the item in its depth row
+	Bool		_hidden;					///< Expected result
+};
+
+
+/// Items of stacks with 8 base items and 4 rows. Interior items of square pyramids are hidden under two layers, those of triangular pyramids only under three.
+static const StackHiddenItemCase g_hiddenItemCases[] =
+{
+	{ STACK_SHAPE_WALL, 0, 0, 3, false },
+	{ STACK_SHAPE_SQUARE, 0, 3, 3, true },
+	{ STACK_SHAPE_SQUARE, 1, 1, 1, true },
+	{ STACK_SHAPE_SQUARE, 2, 1, 1, false },
+	{ STACK_SHAPE_SQUARE, 0, 0, 3, false },
+	{ STACK_SHAPE_SQUARE, 0, 3, 7, false },
+	{ STACK_SHAPE_HEX, 0, 1, 1, true },
+	{ STACK_SHAPE_HEX, 1, 1, 1, false },
+	{ STACK_SHAPE_HEX, 2, 1, 1, false },
+	{ STACK_SHAPE_HEX, 0, 0, 3, false }
+};
+
+
+/// Checks which items are reported as hidden, especially triangular pyramids with exactly two layers above an item, which can still be seen through
+static Bool CheckHiddenItems(SplineObject *, String &details)
+{
+	const Int caseCount = sizeof(g_hiddenItemCases) / sizeof(g_hiddenItemCases[0]);
+	for (Int caseIndex = 0; caseIndex < caseCount; ++caseIndex)
+	{
+		const StackHiddenItemCase &hiddenCase = g_hiddenItemCases[caseIndex];
+		StackParameters params = GetTestParameters(hiddenCase._shape, 8, 4, 80.0, 10.0, 1);
+
+		CanStackGenerator generator;
+		if (!generator.InitStack(params))
+		{
+			details = "Initialization failed for shape " + String::IntToString(hiddenCase._shape);
+			return false;
+		}
+
+		if (generator.IsItemHidden(hiddenCase._rowIndex, hiddenCase._depthRowIndex, hiddenCase._indexInDepthRow) != hiddenCase._hidden)
+		{
+			details = "Shape " + String::IntToString(hiddenCase._shape) + ", row " + String::IntToString(hiddenCase._rowIndex) + ", depth row " + String::IntToString(hiddenCase._depthRowIndex) + ", item " + String::IntToString(hiddenCase._indexInDepthRow) + (hiddenCase._hidden ? " should be hidden" : " should be visible");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/// Measures generation of straight walls with growing base counts, and reports the items per second of each.
+/// Fails if the time per item of the largest stack is a lot longer than the time per item of the smallest one.
+static Bool CheckScaling(SplineObject *, String &details)
+{
+	Float firstTimePerItem = 0.0;
+	Float lastTimePerItem = 0.0;
+	const Int passCount = sizeof(g_selfTestScalingBaseCounts) / sizeof(g_selfTestScalingBaseCounts[0]);
+	for (Int passIndex = 0; passIndex < passCount; ++passIndex)
+	{
+		Int32 baseCount = g_selfTestScalingBaseCounts[passIndex];
+		StackParameters params = GetTestParameters(STACK_SHAPE_WALL, baseCount, Min(baseCount, CANSTACK_SELFTEST_SCALING_ROWS), 10.0 * baseCount, 10.0, 12345);
+
+		// Fastest of several runs, to keep other work on the machine out of the measurement
+		Float fastestTime = 0.0;
+		Int itemCount = 0;
+		for (Int32 run = 0; run < CANSTACK_SELFTEST_SCALING_RUNS; ++run)
+		{
+			CanStackGenerator generator;
+			if (!generator.InitStack(params))
+			{
+				details = "Initialization failed for baseCount " + String::IntToString(baseCount);
+				return false;
+			}
+
+			Float64 timeStart = GeGetMilliSeconds();
+			if (!generator.GenerateStack())
+			{
+				details = "Generation failed for baseCount " + String::IntToString(baseCount);
+				return false;
+			}
+			Float time = GeGetMilliSeconds() - timeStart;
+
+			fastestTime = (run == 0) ? time : Min(fastestTime, time);
+			itemCount = generator.GetItemCount();
+		}
+
+		Float itemsPerSecond = (Float)itemCount * 1000.0 / Max(fastestTime, 0.001);
+		if (passIndex > 0)
+			details += ", ";
+		details += "baseCount " + String::IntToString(baseCount) + ": " + String::FloatToString(itemsPerSecond, -1, 0) + " items/s";
+
+		lastTimePerItem = Max(fastestTime, 0.001) / (Float)Max(itemCount, (Int)1);
+		if (passIndex == 0)
+			firstTimePerItem = lastTimePerItem;
+	}
+
+	// Compare only the smallest and the largest pass. Their item counts differ the most, so a superlinear cost shows the most.
+	if (lastTimePerItem > firstTimePerItem * CANSTACK_SELFTEST_MAX_SCALING)
+	{
+		details += " (time per item grows more than " + String::FloatToString(CANSTACK_SELFTEST_MAX_SCALING, -1, 0) + "x)";
+		return false;
+	}
+
+	return true;
+}
+
+
+/// One check of the self test
+struct StackSelfTestCheck
+{
+	const Char	*_name;																				///< Name that is printed to the console
+	Bool				(*_function)(SplineObject *path, String &details);		///< Function that runs the check. Returns true if passed, and fills details with the reason if not.
+};
+
+
+/// All checks of the self test, in the order they are run
+static const StackSelfTestCheck g_selfTestChecks[] =
+{
+	{ "Row clamp", CheckRowClamp },
+	{ "Golden data", CheckGoldenData },
+	{ "Spline offsets", CheckSplineOffsets },
+	{ "Parallel kernel", CheckParallelKernel },
+	{ "Compact storage", CheckCompactStorage },
+	{ "Hidden items", CheckHiddenItems },
+	{ "Scaling", CheckScaling }
+};
+
+
+Bool RunStackSelfTest()
+{
+	AutoFree<SplineObject> path;
+	path.Set(CreateTestPath());
+	if (!path)
+		return false;
+
+	Bool result = true;
+	const Int checkCount = sizeof(g_selfTestChecks) / sizeof(g_selfTestChecks[0]);
+	for (Int checkIndex = 0; checkIndex < checkCount; ++checkIndex)
+	{
+		const StackSelfTestCheck &check = g_selfTestChecks[checkIndex];
+
+		StatusSetText("CanStack self test: " + String(check._name));
+		StatusSetBar((Int32)(100 * checkIndex / checkCount));
+
+		String details;
+		Bool passed = check._function(path, details);
+		if (!passed)
+			result = false;
+
+		String line = "CanStack self test: " + String(check._name) + (passed ? " passed" : " FAILED");
+		if (details.GetLength() > 0)
+			line += " (" + details + ")";
+		GePrint(line);
+	}
+
+	GePrint(result ? "CanStack self test: All checks passed" : "CanStack self test: Some checks FAILED");
+
+	StatusClear();
+
+	return result;
+}
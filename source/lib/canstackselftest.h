@@ -0,0 +1,16 @@
+#ifndef CANSTACKSELFTEST_H__
+#define CANSTACKSELFTEST_H__
+
+
+#include "c4d.h"
+
+
+/// Runs the CanStackGenerator self test and prints the results to the console.
+/// Checks the row count clamp, compares generated items to golden data for fixed seeds and to a simple serial reference
+/// (for straight stacks of all shapes and for stacks on a linear spline), compares compact to full item storage, checks which items count as hidden, and
+/// measures generation time for growing base counts to catch the time per item growing for larger stacks.
+/// @return												True if all checks passed, otherwise false
+Bool RunStackSelfTest();
+
+
+#endif // CANSTACKSELFTEST_H__
@@ -1,4 +1,47 @@
 #include "objecthelpers.h"
+#include "parallelhelpers.h"
+
+
+/// Number of points per chunk of the parallel bounding box reduction
+static const Int BOUNDINGBOX_CHUNK_SIZE = 65536;
+
+
+/// Extends a bounding box given by its corners by a point
+static inline void AddPointToBounds(Vector &minPoint, Vector &maxPoint, const Vector &point)
+{
+	minPoint.x = Min(minPoint.x, point.x);
+	minPoint.y = Min(minPoint.y, point.y);
+	minPoint.z = Min(minPoint.z, point.z);
+	maxPoint.x = Max(maxPoint.x, point.x);
+	maxPoint.y = Max(maxPoint.y, point.y);
+	maxPoint.z = Max(maxPoint.z, point.z);
+}
+
+
+/// Calculates the bounding box of a range of points. The range must not be empty.
+static void ReducePoints(const Vector *points, Int start, Int end, Vector &minPoint, Vector &maxPoint)
+{
+	// Two independent sets of corners, so consecutive points don't have to wait for each other
+	Vector minA = points[start];
+	Vector maxA = minA;
+	Vector minB = minA;
+	Vector maxB = minA;
+	
+	Int pointIndex = start + 1;
+	for (; pointIndex + 1 < end; pointIndex += 2)
+	{
+		AddPointToBounds(minA, maxA, points[pointIndex]);
+		AddPointToBounds(minB, maxB, points[pointIndex + 1]);
+	}
+	if (pointIndex < end)
+		AddPointToBounds(minA, maxA, points[pointIndex]);
+	
+	// Combine both sets
+	AddPointToBounds(minA, maxA, minB);
+	AddPointToBounds(minA, maxA, maxB);
+	minPoint = minA;
+	maxPoint = maxA;
+}
 
 
 BaseObject *GetCurrentStateToObject(BaseObject *inputObject, Int32 &nodeType)
@@ -74,13 +117,33 @@ MinMax CalculateBoundingBox(BaseObject *inputObject)
 	// Get read-only points array and point count
 	Int32 pointCount = pointObject->GetPointCount();
 	const Vector *padr = pointObject->GetPointR();
-	if (!padr)
+	if (!padr || pointCount <= 0)
 		return MinMax();
 	
-	// Iterate points and extend bounding box
-	for (Int32 i = 0; i < pointCount; i++)
+	// Bounding box of each chunk
+	Int chunkCount = (pointCount + BOUNDINGBOX_CHUNK_SIZE - 1) / BOUNDINGBOX_CHUNK_SIZE;
+	maxon::BaseArray<Vector> chunkMin;
+	maxon::BaseArray<Vector> chunkMax;
+	if (!chunkMin.Resize(chunkCount) || !chunkMax.Resize(chunkCount))
+		return MinMax();
+	
+	// Reduce chunks, on as many threads as there are chunks or cores
+	auto reduceChunks = [padr, pointCount, &chunkMin, &chunkMax](Int start, Int end) -> Bool
 	{
-		boundingBox.AddPoint(padr[i]);
+		for (Int chunkIndex = start; chunkIndex < end; ++chunkIndex)
+		{
+			Int firstPoint = chunkIndex * BOUNDINGBOX_CHUNK_SIZE;
+			ReducePoints(padr, firstPoint, Min(firstPoint + BOUNDINGBOX_CHUNK_SIZE, (Int)pointCount), chunkMin[chunkIndex], chunkMax[chunkIndex]);
+		}
+		return true;
+	};
+	if (!ParallelForRanges(chunkCount, 1, reduceChunks))
+		return MinMax();
+	
+	// Combine chunks
+	for (Int chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+	{
+		boundingBox.AddPoints(chunkMin[chunkIndex], chunkMax[chunkIndex]);
 	}
 	
 	// Return bounding box
@@ -112,54 +175,156 @@ MinMax CalculateHierarchyBoundingBox(BaseObject *inputObject)
 }
 
 
-void TouchAllChildren(BaseObject *startObject)
+void AddTransformedBoundingBox(MinMax &boundingBox, const Matrix &transform, const Vector &center, const Vector &rad)
 {
+	// Extent of the transformed box along each axis
+	Vector transformedCenter = transform * center;
+	Vector transformedRad(Abs(transform.v1.x) * rad.x + Abs(transform.v2.x) * rad.y + Abs(transform.v3.x) * rad.z,
+	                      Abs(transform.v1.y) * rad.x + Abs(transform.v2.y) * rad.y + Abs(transform.v3.y) * rad.z,
+	                      Abs(transform.v1.z) * rad.x + Abs(transform.v2.z) * rad.y + Abs(transform.v3.z) * rad.z);
+	
+	boundingBox.AddPoints(transformedCenter - transformedRad, transformedCenter + transformedRad);
+}
+
+
+Bool GetCachedHierarchyBoundingBox(BaseObject *inputObject, MinMax &boundingBox)
+{
+	boundingBox.Init();
+	
 	// Cancel if no object
-	if (!startObject)
-		return;
+	if (!inputObject)
+		return false;
 	
-	// Get child object
-	BaseObject *childObject = startObject->GetDown();
+	// Everything is transformed into the space of inputObject
+	Matrix invertedMg = ~inputObject->GetMg();
+	Bool hasBounds = false;
 	
-	// Touch child object
-	while (childObject)
+	// Walk hierarchy depth first, without recursion
+	BaseObject *currentObject = inputObject;
+	while (currentObject)
 	{
-		// Touch all children of child object
-		TouchAllChildren(childObject);
-
-		// Touch child object itself
-		childObject->Touch();
+		// Objects without geometry (e.g. Null objects) have no bounds
+		Vector rad = currentObject->GetRad();
+		if (rad.IsNotZero())
+		{
+			AddTransformedBoundingBox(boundingBox, invertedMg * currentObject->GetMg(), currentObject->GetMp(), rad);
+			hasBounds = true;
+		}
 		
-		// Continue with next object
-		childObject = childObject->GetNext();
+		// Descend to children first
+		if (currentObject->GetDown())
+		{
+			currentObject = currentObject->GetDown();
+			continue;
+		}
+		
+		// Go to next object, or back up until there is one. Never leave the hierarchy of inputObject.
+		while (currentObject != inputObject && !currentObject->GetNext())
+			currentObject = currentObject->GetUp();
+		
+		if (currentObject == inputObject)
+			break;
+		
+		currentObject = currentObject->GetNext();
 	}
+	
+	return hasBounds;
 }
 
 
-Bool IsDirtyChildren(BaseObject *startObject, DIRTYFLAGS flags)
+/// Combines a value into a checksum (FNV-1a step)
+static inline UInt32 CombineChecksum(UInt32 checksum, UInt32 value)
 {
+	return (checksum ^ value) * 16777619U;
+}
+
+
+UInt32 GetChildrenDirtyChecksum(BaseObject *startObject, DIRTYFLAGS flags, Bool touch)
+{
+	// FNV offset basis
+	UInt32 checksum = 2166136261U;
+	
 	// Cancel if no object
 	if (!startObject)
-		return false;
+		return checksum;
 	
-	// Get child object
+	// Walk hierarchy depth first, without recursion
 	BaseObject *childObject = startObject->GetDown();
-
-	// Ask children for dirtyness
-	Bool dirty = false;
-	
-	// Return IsDirty() of child object and its children
 	while (childObject)
 	{
-		// Ask children of child object for their dirtyness
-		dirty |= IsDirtyChildren(childObject, flags);
+		// Add child object's identity and dirty count. Replacing or swapping children changes the checksum, even if the dirty counts are equal.
+		UInt64 identity = (UInt64)childObject;
+		checksum = CombineChecksum(checksum, (UInt32)identity);
+		checksum = CombineChecksum(checksum, (UInt32)(identity >> 32));
+		checksum = CombineChecksum(checksum, childObject->GetDirty(flags));
+		
+		// Touch child object
+		if (touch)
+			childObject->Touch();
+		
+		// Descend to children first
+		if (childObject->GetDown())
+		{
+			checksum = CombineChecksum(checksum, 1);
+			childObject = childObject->GetDown();
+			continue;
+		}
+		
+		// Climb up until there is a next object, or we're back at the start
+		while (childObject != startObject && !childObject->GetNext())
+		{
+			checksum = CombineChecksum(checksum, 2);
+			childObject = childObject->GetUp();
+		}
 		
-		// Ask child object for dirtyness
-		dirty |= childObject->IsDirty(flags);
+		if (childObject == startObject)
+			break;
 		
 		// Continue with next object
 		childObject = childObject->GetNext();
 	}
 	
-	return dirty;
+	return checksum;
+}
+
+
+Bool IsObjectVisible(BaseObject *op, BaseDocument *doc, Bool render)
+{
+	if (!op)
+		return false;
+	
+	// Hidden by layer
+	const LayerData *layerData = op->GetLayerData(doc);
+	if (layerData && !(render ? layerData->render : layerData->view))
+		return false;
+	
+	// First mode that is not "default" decides, walking up the hierarchy
+	for (BaseObject *object = op; object; object = object->GetUp())
+	{
+		Int32 mode = render ? object->GetRenderMode() : object->GetEditorMode();
+		if (mode != MODE_UNDEF)
+			return mode == MODE_ON;
+	}
+	
+	return true;
+}
+
+
+Bool IsGeneratorInput(BaseObject *op)
+{
+	if (!op)
+		return false;
+	
+	// Part of another object's cache
+	if (op->GetCacheParent())
+		return true;
+	
+	// Child of a generator
+	for (BaseObject *parent = op->GetUp(); parent; parent = parent->GetUp())
+	{
+		if (parent->GetInfo() & OBJECT_GENERATOR)
+			return true;
+	}
+	
+	return false;
 }
@@ -12,7 +12,7 @@
 /// @return The resulting object, or nullptr if an error occurred. Caller owns the pointed object.
 BaseObject *GetCurrentStateToObject(BaseObject *inputObject, Int32 &nodeType);
 
-/// Calculates the bounding box
+/// Calculates the bounding box. Large point counts are reduced in chunks on all available cores.
 /// @param[in] inputObject The PointObject to calculate the bounding box from
 /// @return The bounding box in object space
 MinMax CalculateBoundingBox(BaseObject *inputObject);
@@ -22,15 +22,81 @@ MinMax CalculateBoundingBox(BaseObject *inputObject);
 /// @return The bounding box for all objects in the hierarchy
 MinMax CalculateHierarchyBoundingBox(BaseObject *inputObject);
 
-/// Recursively touch all child objects of an object
-/// @param[in] startObject The parent object of the hierarchy that should be touched. All child objects (not startObject itself!) will be touched.
-void TouchAllChildren(BaseObject *startObject);
+/// Adds a box that has been transformed by a matrix to a bounding box, as tight as possible without looking at the actual geometry
+/// @param[in,out] boundingBox The bounding box to extend
+/// @param[in] transform Matrix that transforms the box into the bounding box's space
+/// @param[in] center Center of the box
+/// @param[in] rad Radius (half size) of the box
+void AddTransformedBoundingBox(MinMax &boundingBox, const Matrix &transform, const Vector &center, const Vector &rad);
 
-/// Recursively call IsDirty() on all child objects under 'startObject'
-/// @param[in] startObject The parent object of the hierarchy that should be checked for dirtyness. All child objects (not startObject itself!) will be touched.
-/// @param[in] flags DIRTYFLAGS bitmask to use for IsDirty() calls
-/// @return True if any of the child objects is dirty, otherwise false.
-Bool IsDirtyChildren(BaseObject *startObject, DIRTYFLAGS flags);
+/// Calculates the bounding box of an object and all its children from the bounds the objects have cached (GetMp() and GetRad()).
+/// This is much faster than using GetCurrentStateToObject(), but only works for objects that have already been evaluated.
+/// @param[in] inputObject The parent object of the hierarchy. This object and all its children will be iterated.
+/// @param[out] boundingBox Receives the bounding box in the local space of inputObject
+/// @return True if at least one object in the hierarchy has valid bounds, otherwise false
+Bool GetCachedHierarchyBoundingBox(BaseObject *inputObject, MinMax &boundingBox);
+
+/// Remembers the bounding box of one object hierarchy, together with the dirty checksum the object had when the box was calculated
+class BoundingBoxCache
+{
+public:
+	/// Default constructor
+	BoundingBoxCache() : _object(nullptr), _dirty(0), _valid(false)
+	{ }
+	
+	/// Returns the cached bounding box, if it has been calculated for the same object in the same state
+	/// @param[in] object The object the bounding box is requested for
+	/// @param[in] dirty Current dirty checksum of the object
+	/// @param[out] boundingBox Receives the cached bounding box
+	/// @return True if the cached bounding box is valid, otherwise false
+	Bool Get(BaseObject *object, UInt32 dirty, MinMax &boundingBox) const
+	{
+		if (!_valid || object != _object || dirty != _dirty)
+			return false;
+		boundingBox = _boundingBox;
+		return true;
+	}
+	
+	/// Stores a bounding box
+	/// @param[in] object The object the bounding box has been calculated for
+	/// @param[in] dirty Dirty checksum of the object
+	/// @param[in] boundingBox The bounding box
+	void Set(BaseObject *object, UInt32 dirty, const MinMax &boundingBox)
+	{
+		_object = object;
+		_dirty = dirty;
+		_boundingBox = boundingBox;
+		_valid = true;
+	}
+	
+private:
+	BaseObject	*_object;				///< Object the bounding box has been calculated for (only used for comparison)
+	UInt32			_dirty;					///< Dirty checksum of the object
+	MinMax			_boundingBox;		///< The cached bounding box
+	Bool				_valid;					///< True if a bounding box has been stored
+};
+
+/// Iterates all child objects under 'startObject' in a single non-recursive pass and combines their dirty checksums.
+/// Optionally touches all child objects in the same pass.
+/// @param[in] startObject The parent object of the hierarchy that should be checked. Only child objects (not startObject itself!) are evaluated.
+/// @param[in] flags DIRTYFLAGS bitmask to use for GetDirty() calls
+/// @param[in] touch If true, all child objects are touched
+/// @return A checksum that changes whenever any of the child objects, the set of child objects, or the structure of the hierarchy changes
+UInt32 GetChildrenDirtyChecksum(BaseObject *startObject, DIRTYFLAGS flags, Bool touch);
+
+/// Tells if an object is visible in the editor or in renderings. Looks at the object's own visibility mode, then at the modes of its parents
+/// (as long as the mode is "default"), and at the object's layer.
+/// @param[in] op The object to check
+/// @param[in] doc The document of the object, used for looking up its layer
+/// @param[in] render If true, the render visibility is checked, otherwise the editor visibility
+/// @return True if the object is visible
+Bool IsObjectVisible(BaseObject *op, BaseDocument *doc, Bool render);
+
+/// Tells if an object is used as input of another generator, i.e. if it is in the cache of another object, or if any of its parents is a generator (e.g. a Cloner or Connect object).
+/// Such objects are often hidden, while their output is still used by the generator. References from other objects (e.g. Instance objects) can't be detected.
+/// @param[in] op The object to check
+/// @return True if the object is used as input of another generator
+Bool IsGeneratorInput(BaseObject *op);
 
 
 #endif // WS_BOUNDINGBOX_H__
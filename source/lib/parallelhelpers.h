@@ -0,0 +1,113 @@
+#ifndef PARALLELHELPERS_H__
+#define PARALLELHELPERS_H__
+
+
+#include "c4d.h"
+
+
+/// Thread that calls a worker function for one range of indices.
+/// Used internally by ParallelForRanges().
+template <typename WORKER>
+class ParallelRangeThread : public C4DThread
+{
+public:
+	/// Default constructor
+	ParallelRangeThread() : _worker(nullptr), _start(0), _end(0), _result(false)
+	{ }
+
+	/// Sets worker and index range to process
+	/// @param[in] worker							Pointer to the worker function object
+	/// @param[in] start							First index of the range
+	/// @param[in] end								Index after the last index of the range
+	void SetRange(WORKER *worker, Int start, Int end)
+	{
+		_worker = worker;
+		_start = start;
+		_end = end;
+		_result = false;
+	}
+
+	/// Returns the result of the worker function
+	Bool GetResult() const
+	{
+		return _result;
+	}
+
+	virtual void Main()
+	{
+		_result = (*_worker)(_start, _end);
+	}
+
+	virtual const Char *GetThreadName()
+	{
+		return "CanStackRangeThread";
+	}
+
+private:
+	WORKER	*_worker;		///< Worker function object
+	Int			_start;			///< First index of the range
+	Int			_end;				///< Index after the last index of the range
+	Bool		_result;		///< Result of the worker function
+};
+
+
+/// Splits the index range [0, count) into consecutive ranges and calls worker(start, end) for each of them.
+/// The ranges are distributed over all available cores, the calling thread processes the first range itself.
+/// The worker must only write data that belongs to its own range.
+/// @param[in] count							Number of indices to process
+/// @param[in] minRangeSize				Minimum number of indices per range. Small counts are processed on the calling thread only.
+/// @param[in] worker							Function object with signature Bool (Int start, Int end)
+/// @return												True if all calls of the worker returned true, otherwise false.
+template <typename WORKER>
+Bool ParallelForRanges(Int count, Int minRangeSize, WORKER &worker)
+{
+	if (count <= 0)
+		return true;
+
+	// Don't use more threads than there are cores, or than there is work
+	Int rangeCount = Min((Int)GeGetCurrentThreadCount(), (count + minRangeSize - 1) / Max(minRangeSize, (Int)1));
+	if (rangeCount <= 1)
+		return worker((Int)0, count);
+
+	Int rangeSize = (count + rangeCount - 1) / rangeCount;
+
+	// Allocate threads for all ranges except the first one
+	maxon::BaseArray<ParallelRangeThread<WORKER>*> threads;
+	if (!threads.Resize(rangeCount - 1))
+		return false;
+
+	Bool result = true;
+	for (Int i = 0; i < threads.GetCount(); ++i)
+	{
+		threads[i] = NewObj(ParallelRangeThread<WORKER>);
+		if (!threads[i])
+		{
+			result = false;
+			continue;
+		}
+
+		// Start thread for its range
+		Int start = (i + 1) * rangeSize;
+		threads[i]->SetRange(&worker, Min(start, count), Min(start + rangeSize, count));
+		threads[i]->Start(THREADMODE_ASYNC);
+	}
+
+	// Process first range on calling thread
+	result &= worker((Int)0, Min(rangeSize, count));
+
+	// Wait for all other ranges, collect results and free threads
+	for (Int i = 0; i < threads.GetCount(); ++i)
+	{
+		if (!threads[i])
+			continue;
+
+		threads[i]->Wait(false);
+		result &= threads[i]->GetResult();
+		DeleteObj(threads[i]);
+	}
+
+	return result;
+}
+
+
+#endif // PARALLELHELPERS_H__
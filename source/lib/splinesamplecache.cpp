@@ -0,0 +1,110 @@
+#include "splinesamplecache.h"
+
+
+Bool SplineSampleCache::Update(SplineObject *spline, Int segmentCount)
+{
+	if (!spline || segmentCount < 1)
+		return false;
+
+	// Nothing to do if we already have samples of this spline in its current state
+	UInt32 splineDirty = spline->GetDirty(DIRTYFLAGS_DATA);
+	if (spline == _spline && splineDirty == _splineDirty && segmentCount == _segmentCount)
+		return true;
+
+	// Invalidate existing samples
+	Reset();
+
+	// Allocate SplineLengthData
+	if (!_splineLengthData)
+	{
+		_splineLengthData.Set(SplineLengthData::Alloc());
+		if (!_splineLengthData)
+			return false;
+	}
+
+	// Initialize SplineLengthData
+	if (!_splineLengthData->Init(spline))
+		return false;
+
+	// Allocate sample arrays
+	if (!_positions.Resize(segmentCount + 1) || !_tangents.Resize(segmentCount + 1))
+		return false;
+
+	// Take samples at equal arc length steps
+	Float segmentFactor = 1.0 / (Float)segmentCount;
+	for (Int sampleIndex = 0; sampleIndex <= segmentCount; ++sampleIndex)
+	{
+		Float naturalOffset = _splineLengthData->UniformToNatural((Float)sampleIndex * segmentFactor);
+		_positions[sampleIndex] = spline->GetSplinePoint(naturalOffset);
+		_tangents[sampleIndex] = spline->GetSplineTangent(naturalOffset);
+	}
+
+	// Remember what we've sampled
+	_spline = spline;
+	_splineDirty = splineDirty;
+	_segmentCount = segmentCount;
+
+	return true;
+}
+
+
+void SplineSampleCache::Sample(Float offset, Vector &position, Vector &tangent) const
+{
+	// Find segment and position within segment
+	Float segmentOffset = ClampValue(offset, 0.0, 1.0) * (Float)_segmentCount;
+	Int sampleIndex = Min((Int)segmentOffset, _segmentCount - 1);
+	Float blend = segmentOffset - (Float)sampleIndex;
+
+	// Exactly on a sample
+	if (blend <= 0.0)
+	{
+		position = _positions[sampleIndex];
+		tangent = _tangents[sampleIndex];
+		return;
+	}
+
+	// Interpolate between neighbouring samples
+	position = Blend(_positions[sampleIndex], _positions[sampleIndex + 1], blend);
+	tangent = Blend(_tangents[sampleIndex], _tangents[sampleIndex + 1], blend).GetNormalized();
+}
+
+
+Bool SplineSampleCache::GetLength(SplineObject *spline, Float &length)
+{
+	if (!spline)
+		return false;
+
+	// Nothing to do if we already have measured this spline in its current state
+	UInt32 splineDirty = spline->GetDirty(DIRTYFLAGS_DATA);
+	if (spline != _lengthSpline || splineDirty != _lengthSplineDirty)
+	{
+		// Allocate SplineLengthData
+		if (!_splineLengthData)
+		{
+			_splineLengthData.Set(SplineLengthData::Alloc());
+			if (!_splineLengthData)
+				return false;
+		}
+
+		// Measure spline
+		if (!_splineLengthData->Init(spline))
+			return false;
+
+		_length = _splineLengthData->GetLength();
+		_lengthSpline = spline;
+		_lengthSplineDirty = splineDirty;
+	}
+
+	length = _length;
+	return true;
+}
+
+
+void SplineSampleCache::Reset()
+{
+	_positions.Reset();
+	_tangents.Reset();
+	_spline = nullptr;
+	_splineDirty = 0;
+	_segmentCount = 0;
+}
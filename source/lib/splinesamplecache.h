@@ -0,0 +1,57 @@
+#ifndef SPLINESAMPLECACHE_H__
+#define SPLINESAMPLECACHE_H__
+
+
+#include "c4d.h"
+
+
+/// Caches uniformly distributed samples (positions and tangents) of a spline.
+/// The samples are taken in spline space at equal arc length steps. As long as the spline doesn't change,
+/// points on the spline can be looked up without touching SplineLengthData or the spline itself.
+/// Lookups are read-only and can be done from multiple threads.
+class SplineSampleCache
+{
+public:
+	/// Makes sure the cache holds samples for a spline. Only resamples if the spline has changed since the last call, or if a different segment count is requested.
+	/// @param[in] spline							The spline to sample
+	/// @param[in] segmentCount				Number of equally long segments the spline is divided into. There will be segmentCount+1 samples.
+	/// @return												True if successful, otherwise false
+	Bool Update(SplineObject *spline, Int segmentCount);
+
+	/// Returns position and tangent of a point on the spline, interpolated from the samples.
+	/// Positions that fall exactly on a sample return the exact sampled values.
+	/// @param[in] offset							Uniform (arc length) offset on the spline, 0.0 is the start, 1.0 the end
+	/// @param[out] position					Position of the point in spline space
+	/// @param[out] tangent						Normalized tangent at the point in spline space
+	void Sample(Float offset, Vector &position, Vector &tangent) const;
+
+	/// Returns the length of a spline. Only measures again if the spline has changed since the last call.
+	/// @param[in] spline							The spline to measure
+	/// @param[out] length						Receives the length of the spline in spline space
+	/// @return												True if successful, otherwise false
+	Bool GetLength(SplineObject *spline, Float &length);
+
+	/// Frees the samples and invalidates the cache
+	void Reset();
+
+	// Default constructor
+	SplineSampleCache() : _spline(nullptr), _splineDirty(0), _segmentCount(0), _lengthSpline(nullptr), _lengthSplineDirty(0), _length(0.0)
+	{ }
+
+private:
+	/// SplineLengthData object required to take uniform samples.
+	/// Will be allocated only when needed, and freed automatically
+	AutoFree<SplineLengthData> _splineLengthData;
+
+	maxon::BaseArray<Vector>	_positions;			///< Sampled positions
+	maxon::BaseArray<Vector>	_tangents;			///< Sampled tangents
+	SplineObject							*_spline;				///< The spline the samples have been taken from (only used for comparison)
+	UInt32										_splineDirty;		///< Dirty checksum of the spline when it was sampled
+	Int												_segmentCount;	///< Number of segments the spline has been divided into
+	SplineObject							*_lengthSpline;	///< The spline that has been measured (only used for comparison)
+	UInt32										_lengthSplineDirty;	///< Dirty checksum of the spline when it was measured
+	Float											_length;				///< Measured length of the spline
+};
+
+
+#endif // SPLINESAMPLECACHE_H__
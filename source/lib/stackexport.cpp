@@ -0,0 +1,138 @@
+#include "stackexport.h"
+
+
+/// Version of the file format
+static const UInt32 STACKEXPORT_VERSION = 1;
+
+/// Size of one item in the file in bytes
+static const Int STACKEXPORT_ITEM_SIZE = 56;
+
+/// Number of items that are encoded into the buffer before it's written to the file
+static const Int STACKEXPORT_BLOCK_SIZE = 4096;
+
+
+/// Encodes a 32 bit value in little endian byte order, regardless of the platform
+/// @param[in] buffer							Where to write the value
+/// @param[in] value							The value
+/// @return												Position behind the value
+static inline UChar *PutUInt32(UChar *buffer, UInt32 value)
+{
+	buffer[0] = (UChar)(value);
+	buffer[1] = (UChar)(value >> 8);
+	buffer[2] = (UChar)(value >> 16);
+	buffer[3] = (UChar)(value >> 24);
+	return buffer + 4;
+}
+
+
+/// Encodes a 64 bit value in little endian byte order, regardless of the platform
+/// @param[in] buffer							Where to write the value
+/// @param[in] value							The value
+/// @return												Position behind the value
+static inline UChar *PutUInt64(UChar *buffer, UInt64 value)
+{
+	buffer = PutUInt32(buffer, (UInt32)value);
+	return PutUInt32(buffer, (UInt32)(value >> 32));
+}
+
+
+/// Encodes a 32 bit float in little endian byte order, regardless of the platform
+/// @param[in] buffer							Where to write the value
+/// @param[in] value							The value
+/// @return												Position behind the value
+static inline UChar *PutFloat32(UChar *buffer, Float value)
+{
+	Float32 singleValue = (Float32)value;
+	UInt32 bits = 0;
+	CopyMem(&singleValue, &bits, sizeof(bits));
+	return PutUInt32(buffer, bits);
+}
+
+
+/// Encodes a vector as three 32 bit floats
+/// @param[in] buffer							Where to write the vector
+/// @param[in] value							The vector
+/// @return												Position behind the vector
+static inline UChar *PutVector32(UChar *buffer, const Vector &value)
+{
+	buffer = PutFloat32(buffer, value.x);
+	buffer = PutFloat32(buffer, value.y);
+	return PutFloat32(buffer, value.z);
+}
+
+
+Bool ExportStackInstances(const CanStackGenerator &generator, BaseObject *firstSource, const Matrix &mg, const Filename &filename)
+{
+	if (!firstSource || !generator.IsGenerated())
+		return false;
+	
+	AutoAlloc<BaseFile> file;
+	if (!file || !file->Open(filename, FILEOPEN_WRITE, FILEDIALOG_ANY, BYTEORDER_INTEL))
+		return false;
+	
+	Int32 sourceCount = generator.GetVariationCount();
+	Int itemCount = generator.GetItemCount();
+	
+	// Header
+	UChar header[32];
+	UChar *position = header;
+	*position++ = 'C';
+	*position++ = 'S';
+	*position++ = 'T';
+	*position++ = 'K';
+	position = PutUInt32(position, STACKEXPORT_VERSION);
+	position = PutUInt32(position, (UInt32)sourceCount);
+	position = PutUInt32(position, 0);
+	position = PutUInt64(position, (UInt64)itemCount);
+	position = PutUInt64(position, generator.GetLayoutFingerprint());
+	if (!file->WriteBytes(header, position - header))
+		return false;
+	
+	// Source names
+	BaseObject *source = firstSource;
+	for (Int32 sourceIndex = 0; sourceIndex < sourceCount; ++sourceIndex)
+	{
+		String name = source ? source->GetName() : String();
+		Char *nameBytes = name.GetCStringCopy(STRINGENCODING_UTF8);
+		if (!nameBytes)
+			return false;
+		
+		UChar nameLength[4];
+		UInt32 byteCount = (UInt32)name.GetCStringLen(STRINGENCODING_UTF8);
+		PutUInt32(nameLength, byteCount);
+		Bool written = file->WriteBytes(nameLength, 4) && file->WriteBytes(nameBytes, byteCount);
+		DeleteMem(nameBytes);
+		if (!written)
+			return false;
+		
+		source = source ? source->GetNext() : nullptr;
+	}
+	
+	// Items, encoded block by block, so memory usage doesn't grow with the stack
+	maxon::BaseArray<UChar> buffer;
+	if (!buffer.Resize(STACKEXPORT_BLOCK_SIZE * STACKEXPORT_ITEM_SIZE))
+		return false;
+	
+	Matrix invertedMg = ~mg;
+	for (Int blockStart = 0; blockStart < itemCount; blockStart += STACKEXPORT_BLOCK_SIZE)
+	{
+		Int blockEnd = Min(blockStart + STACKEXPORT_BLOCK_SIZE, itemCount);
+		
+		position = buffer.GetFirst();
+		for (Int itemIndex = blockStart; itemIndex < blockEnd; ++itemIndex)
+		{
+			Matrix itemMatrix = generator.GetItemMatrix(itemIndex, invertedMg);
+			position = PutUInt32(position, (UInt32)generator.GetItemVariation(itemIndex));
+			position = PutFloat32(position, generator.GetItemRandomValue(itemIndex));
+			position = PutVector32(position, itemMatrix.off);
+			position = PutVector32(position, itemMatrix.v1);
+			position = PutVector32(position, itemMatrix.v2);
+			position = PutVector32(position, itemMatrix.v3);
+		}
+		
+		if (!file->WriteBytes(buffer.GetFirst(), position - buffer.GetFirst()))
+			return false;
+	}
+	
+	return file->Close();
+}
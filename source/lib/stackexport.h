@@ -0,0 +1,42 @@
+#ifndef STACKEXPORT_H__
+#define STACKEXPORT_H__
+
+
+#include "c4d.h"
+#include "canstackgenerator.h"
+
+
+/*
+	Stack instance file (.cstk), all values little endian:
+
+	Header
+		Char[4]		Magic "CSTK"
+		UInt32		Format version (1)
+		UInt32		Number of sources
+		UInt32		Reserved (0)
+		UInt64		Number of items
+		UInt64		Layout fingerprint (see CanStackGenerator::GetLayoutFingerprint()). It stays the same across sessions, and only
+							changes with the parameters that place the items. It doesn't cover the contents of the source objects or the path spline.
+
+	Sources, one per variation
+		UInt32		Length of the name in bytes
+		Char[]		Name of the source object, UTF-8, not terminated
+
+	Items, 56 bytes each
+		Int32			Source (variation) index
+		Float32		Random value
+		Float32[12]	Matrix relative to the Stack object: off, v1, v2, v3
+ */
+
+
+/// Writes the items of a generated stack as instance data to a file: One reference per source object, and one matrix per item.
+/// The items are read straight from the generator, no objects are built.
+/// @param[in] generator					A generator that has generated its stack
+/// @param[in] firstSource				The first stacked object. If the stack has more than one variation, its next siblings are the other sources.
+/// @param[in] mg									Global matrix of the Stack object
+/// @param[in] filename						The file to write
+/// @return												True if successful, otherwise false
+Bool ExportStackInstances(const CanStackGenerator &generator, BaseObject *firstSource, const Matrix &mg, const Filename &filename);
+
+
+#endif // STACKEXPORT_H__
@@ -0,0 +1,38 @@
+#ifndef STACKRANDOM_H__
+#define STACKRANDOM_H__
+
+
+#include "c4d.h"
+
+
+/// Random streams, each item draws one value from every stream
+enum STACKRANDOM
+{
+	STACKRANDOM_ROT		= 0,		///< Random rotation
+	STACKRANDOM_OFFX	= 1,		///< Random X offset
+	STACKRANDOM_OFFZ	= 2,		///< Random Z offset
+	STACKRANDOM_COUNT					///< Number of random streams
+};
+
+
+/// Counter based random number generator. Returns the same value for the same seed, item and stream,
+/// no matter in which order or on which thread the items are computed.
+/// @param[in] seed								The random seed
+/// @param[in] itemIndex					Index of the item in the stack
+/// @param[in] stream							Random stream, see STACKRANDOM
+/// @return												Random value in the range [-1.0, 1.0]
+static inline Float StackRandom11(UInt32 seed, Int itemIndex, Int32 stream)
+{
+	// Combine seed and counter, then scramble them (SplitMix64 finalizer)
+	UInt64 x = ((UInt64)seed << 32) ^ ((UInt64)itemIndex * STACKRANDOM_COUNT + (UInt64)stream);
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	
+	// Use upper 53 bits as mantissa of a value in [0.0, 1.0), then map to [-1.0, 1.0]
+	return (Float)(x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+
+#endif // STACKRANDOM_H__
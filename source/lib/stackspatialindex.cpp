@@ -0,0 +1,72 @@
+#include "stackspatialindex.h"
+
+
+/// Minimum number of buckets in the hash table
+static const UInt32 STACKSPATIALINDEX_MIN_BUCKETS = 16;
+
+
+Bool StackSpatialIndex::Build(const Vector *positions, Int count, Float cellSize)
+{
+	Reset();
+
+	if (!positions || count <= 0 || cellSize <= 0.0)
+		return count == 0;
+
+	_cellSize = cellSize;
+	_inverseCellSize = 1.0 / cellSize;
+
+	// About two buckets per point keeps collisions between cells rare
+	UInt32 bucketCount = STACKSPATIALINDEX_MIN_BUCKETS;
+	while ((Int)bucketCount < count * 2 && bucketCount < ((UInt32)1 << 30))
+		bucketCount <<= 1;
+	_bucketMask = bucketCount - 1;
+
+	// Bucket of each point, and the next free entry of each bucket while sorting
+	maxon::BaseArray<UInt32> pointBuckets;
+	maxon::BaseArray<Int> bucketCursors;
+	if (!pointBuckets.Resize(count) || !bucketCursors.Resize(bucketCount) || !_bucketStarts.Resize(bucketCount + 1) || !_pointIndices.Resize(count) || !_positions.Resize(count))
+	{
+		Reset();
+		return false;
+	}
+
+	// Count points per bucket
+	for (UInt32 bucket = 0; bucket <= bucketCount; ++bucket)
+		_bucketStarts[bucket] = 0;
+
+	for (Int pointIndex = 0; pointIndex < count; ++pointIndex)
+	{
+		const Vector &position = positions[pointIndex];
+		UInt32 bucket = GetBucket(GetCellCoordinate(position.x), GetCellCoordinate(position.y), GetCellCoordinate(position.z));
+		pointBuckets[pointIndex] = bucket;
+		_bucketStarts[bucket + 1]++;
+	}
+
+	// Turn counts into start offsets
+	for (UInt32 bucket = 0; bucket < bucketCount; ++bucket)
+	{
+		_bucketStarts[bucket + 1] += _bucketStarts[bucket];
+		bucketCursors[bucket] = _bucketStarts[bucket];
+	}
+
+	// Sort point indices and positions into their buckets, in ascending order within each bucket
+	for (Int pointIndex = 0; pointIndex < count; ++pointIndex)
+	{
+		Int entry = bucketCursors[pointBuckets[pointIndex]]++;
+		_pointIndices[entry] = pointIndex;
+		_positions[entry] = positions[pointIndex];
+	}
+
+	return true;
+}
+
+
+void StackSpatialIndex::Reset()
+{
+	_bucketStarts.Flush();
+	_pointIndices.Flush();
+	_positions.Flush();
+	_cellSize = 0.0;
+	_inverseCellSize = 0.0;
+	_bucketMask = 0;
+}
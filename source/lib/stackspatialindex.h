@@ -0,0 +1,122 @@
+#ifndef STACKSPATIALINDEX_H__
+#define STACKSPATIALINDEX_H__
+
+
+#include "c4d.h"
+
+
+/// Uniform grid over a set of points, for finding the neighbours of a point without testing all other points.
+/// The grid cells are hashed into a table of buckets. All point indices are stored in one array, sorted by bucket,
+/// and each bucket only stores where its part of that array starts. Building takes two passes over the points.
+/// The positions are stored in the same order, so a query reads the points of a cell from consecutive memory.
+/// Lookups are read-only and can be done from multiple threads.
+class StackSpatialIndex
+{
+public:
+	/// Sorts points into the grid. Replaces any points that have been added before.
+	/// @param[in] positions					Array of point positions. They are copied, so the array doesn't have to stay valid.
+	/// @param[in] count							Number of points
+	/// @param[in] cellSize						Edge length of a grid cell. Should be at least the distance up to which neighbours are searched.
+	/// @return												True if successful, otherwise false
+	Bool Build(const Vector *positions, Int count, Float cellSize);
+
+	/// Calls a function for every point within a radius around a position.
+	/// Points are visited in a fixed order that only depends on the points passed to Build(), and the position and radius.
+	/// @param[in] center							The position to search around
+	/// @param[in] radius							Maximum distance of a point from the center
+	/// @param[in] callback						Function object with signature void (Int pointIndex, const Vector &position)
+	template <typename ItemCallback>
+	void ForEachInRadius(const Vector &center, Float radius, const ItemCallback &callback) const
+	{
+		if (_pointIndices.GetCount() == 0 || radius < 0.0)
+			return;
+
+		Float radiusSquared = radius * radius;
+
+		// Range of cells that touch the sphere
+		Int32 minX = GetCellCoordinate(center.x - radius);
+		Int32 minY = GetCellCoordinate(center.y - radius);
+		Int32 minZ = GetCellCoordinate(center.z - radius);
+		Int32 maxX = GetCellCoordinate(center.x + radius);
+		Int32 maxY = GetCellCoordinate(center.y + radius);
+		Int32 maxZ = GetCellCoordinate(center.z + radius);
+
+		// If there are more cells than points, testing all points is cheaper
+		Float cellCount = ((Float)maxX - minX + 1.0) * ((Float)maxY - minY + 1.0) * ((Float)maxZ - minZ + 1.0);
+		if (cellCount > (Float)_pointIndices.GetCount())
+		{
+			for (Int entry = 0; entry < _pointIndices.GetCount(); ++entry)
+			{
+				if ((_positions[entry] - center).GetSquaredLength() <= radiusSquared)
+					callback(_pointIndices[entry], _positions[entry]);
+			}
+			return;
+		}
+
+		for (Int32 cellX = minX; cellX <= maxX; ++cellX)
+		{
+			for (Int32 cellY = minY; cellY <= maxY; ++cellY)
+			{
+				for (Int32 cellZ = minZ; cellZ <= maxZ; ++cellZ)
+				{
+					UInt32 bucket = GetBucket(cellX, cellY, cellZ);
+					for (Int entry = _bucketStarts[bucket]; entry < _bucketStarts[bucket + 1]; ++entry)
+					{
+						const Vector &position = _positions[entry];
+						if ((position - center).GetSquaredLength() > radiusSquared)
+							continue;
+
+						// Other cells can share the bucket. Only report points from this cell, so none is reported twice.
+						if (GetCellCoordinate(position.x) != cellX || GetCellCoordinate(position.y) != cellY || GetCellCoordinate(position.z) != cellZ)
+							continue;
+
+						callback(_pointIndices[entry], position);
+					}
+				}
+			}
+		}
+	}
+
+	/// Returns the number of points in the grid
+	Int GetCount() const
+	{
+		return _pointIndices.GetCount();
+	}
+
+	/// Returns the cell size passed to Build()
+	Float GetCellSize() const
+	{
+		return _cellSize;
+	}
+
+	/// Frees all data
+	void Reset();
+
+	// Default constructor
+	StackSpatialIndex() : _cellSize(0.0), _inverseCellSize(0.0), _bucketMask(0)
+	{ }
+
+private:
+	/// Returns the grid coordinate of a position component
+	Int32 GetCellCoordinate(Float value) const
+	{
+		// Clamp, so positions far away from the origin don't overflow
+		return (Int32)ClampValue(Floor(value * _inverseCellSize), (Float)LIMIT<Int32>::MIN, (Float)LIMIT<Int32>::MAX);
+	}
+
+	/// Returns the bucket a grid cell is hashed to
+	UInt32 GetBucket(Int32 cellX, Int32 cellY, Int32 cellZ) const
+	{
+		return (((UInt32)cellX * 73856093U) ^ ((UInt32)cellY * 19349663U) ^ ((UInt32)cellZ * 83492791U)) & _bucketMask;
+	}
+
+	maxon::BaseArray<Int>	_bucketStarts;		///< Index of the first entry of each bucket in _pointIndices, plus the total count at the end
+	maxon::BaseArray<Int>	_pointIndices;		///< Indices of all points, sorted by bucket
+	maxon::BaseArray<Vector>	_positions;		///< Positions of all points, in the same order as _pointIndices
+	Float									_cellSize;				///< Edge length of a grid cell
+	Float									_inverseCellSize;	///< 1.0 / _cellSize
+	UInt32								_bucketMask;			///< Number of buckets - 1 (the number of buckets is a power of 2)
+};
+
+
+#endif // STACKSPATIALINDEX_H__
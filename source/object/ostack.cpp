@@ -1,6 +1,9 @@
 #include "c4d.h"
 #include "canstackgenerator.h"
 #include "objecthelpers.h"
+#include "canstackbenchmark.h"
+#include "canstackselftest.h"
+#include "stackexport.h"
 #include "c4d_symbols.h"
 #include "ostack.h"
 #include "main.h"
@@ -9,6 +12,35 @@
 const Int32 ID_STACK = 1038758;	///< Unique ID obtained from www.plugincafe.com
 
 
+/// Statistics about the work a Stack object has done. Only collected if STACK_STATS_ENABLE is set.
+struct StackStatistics
+{
+	Int32		_cacheHits;				///< Number of times the previously generated cache was returned
+	Int32		_cacheUpdates;		///< Number of times the cached items were moved in place
+	Int32		_cacheRebuilds;		///< Number of times the whole geometry was rebuilt
+	Int			_itemCount;				///< Number of items in the last generated stack
+	Float		_timeInit;				///< Duration of the last InitStack() call in milliseconds
+	Float		_timeGenerate;		///< Duration of the last GenerateStack() call in milliseconds
+	Float		_timeBuild;				///< Duration of the last BuildStackGeometry() or UpdateStackGeometry() call in milliseconds
+	
+	/// Default constructor
+	StackStatistics() : _cacheHits(0), _cacheUpdates(0), _cacheRebuilds(0), _itemCount(0), _timeInit(0.0), _timeGenerate(0.0), _timeBuild(0.0)
+	{ }
+	
+	/// Returns a one-line summary of the statistics, for printing to the console
+	String ToString() const
+	{
+		return String::IntToString(_itemCount) + " items, " +
+		       "init " + String::FloatToString(_timeInit) + " ms, " +
+		       "generate " + String::FloatToString(_timeGenerate) + " ms, " +
+		       "build " + String::FloatToString(_timeBuild) + " ms, " +
+		       String::IntToString(_cacheHits) + " cache hits, " +
+		       String::IntToString(_cacheUpdates) + " updates, " +
+		       String::IntToString(_cacheRebuilds) + " rebuilds";
+	}
+};
+
+
 /// Stack Object class declaration
 class StackObject : public ObjectData
 {
@@ -18,7 +50,10 @@ public:
 	virtual Bool Init(GeListNode *node);
 	virtual Bool Message(GeListNode *node, Int32 type, void *t_data);
 	virtual Bool GetDEnabling(GeListNode *node, const DescID &id, const GeData &t_data, DESCFLAGS_ENABLE flags, const BaseContainer *itemdesc);
+	virtual Bool GetDParameter(GeListNode *node, const DescID &id, GeData &t_data, DESCFLAGS_GET &flags);
 	virtual Bool CopyTo(NodeData *dest, GeListNode *snode, GeListNode *dnode, COPYFLAGS flags, AliasTrans *trn);
+	virtual Bool Read(GeListNode *node, HyperFile *hf, Int32 level);
+	virtual Bool Write(GeListNode *node, HyperFile *hf);
 
 	virtual BaseObject* GetVirtualObjects(BaseObject *op, HierarchyHelp *hh);
 
@@ -28,12 +63,37 @@ public:
 	}
 	
 	
-	StackObject() : _lastPathSpline(nullptr)
+	StackObject() : _lastPathSpline(nullptr), _lastChildrenDirty(0), _itemRadDirty(0), _itemRadValid(false), _placeholder(false)
 	{ }
 	
 private:
+	/// Returns the largest bounding box radius of the stacked objects, from the bounds they have cached.
+	/// The hierarchies are only walked again if the stacked objects have changed. If none of them has bounds
+	/// (e.g. because they have not been evaluated yet), the last measured radius is kept.
+	/// @param[in] firstVariation			The first stacked object, the others are its next siblings
+	/// @param[in] variationCount			Number of stacked objects
+	/// @param[in] childrenDirty			Dirty checksum of the Stack object's children
+	/// @param[out] itemRad						Receives the radius
+	/// @return												True if a radius is known, false if the stacked objects have never had bounds
+	Bool GetItemRadius(BaseObject *firstVariation, Int32 variationCount, UInt32 childrenDirty, Vector &itemRad);
+	
+	/// Stores timings and counters of a GetVirtualObjects() call that generated a stack, and prints them if requested
+	/// @param[in] op									The Stack object
+	/// @param[in] rebuilt						True if the geometry was rebuilt, false if the cached items were updated in place
+	/// @param[in] timeStart					Time before InitStack() was called
+	/// @param[in] timeInit						Time after InitStack() returned
+	/// @param[in] timeGenerate				Time after GenerateStack() returned
+	void RecordStatistics(BaseObject *op, Bool rebuilt, Float64 timeStart, Float64 timeInit, Float64 timeGenerate);
+	
 	CanStackGenerator	_stackGenerator;	///< The stack generator
 	BaseObject*				_lastPathSpline;	///< Pointer to the last used path spline object (used for comparison during dirty detection)
+	UInt32						_lastChildrenDirty;	///< Combined dirty checksum of all child objects when the stack was last generated
+	StackStatistics		_statistics;			///< Statistics shown in the "Statistics" tab
+	BoundingBoxCache	_fitHeightBounds;	///< Bounding box of the child calculated by the last "Fit Height" command
+	Vector						_itemRad;					///< Largest bounding box radius of the stacked objects, see GetItemRadius()
+	UInt32						_itemRadDirty;		///< Dirty checksum of the stacked objects when _itemRad was measured
+	Bool							_itemRadValid;		///< True if _itemRad has been measured
+	Bool							_placeholder;			///< True if the current cache is an empty placeholder, returned while the object is hidden
 };
 
 
@@ -49,15 +109,33 @@ Bool StackObject::Init(GeListNode *node)
 	BaseContainer *data = op->GetDataInstance();
 
 	// Set default attributes
+	data->SetInt32(STACK_SHAPE, STACK_SHAPE_WALL);
 	data->SetFloat(STACK_BASE_LENGTH, 100.0);
 	data->SetInt32(STACK_BASE_COUNT, 3);
 	data->SetInt32(STACK_ROWS_COUNT, 3);
+	data->SetBool(STACK_BASE_FITCOUNT, false);
 	data->SetFloat(STACK_ROWS_HEIGHT, 20.0);
 	data->SetBool(STACK_RENDERINSTANCES, true);
 	data->SetUInt32(STACK_RANDOM_SEED, 12345);
 	data->SetFloat(STACK_RANDOM_ROT, 0.0);
 	data->SetFloat(STACK_RANDOM_OFF_X, 0.0);
 	data->SetFloat(STACK_RANDOM_OFF_Z, 0.0);
+	data->SetInt32(STACK_SETTLE_ITERATIONS, 0);
+	data->SetBool(STACK_RANDOM_COLORS, false);
+	data->SetVector(STACK_RANDOM_COLOR_1, Vector(0.8, 0.2, 0.1));
+	data->SetVector(STACK_RANDOM_COLOR_2, Vector(0.1, 0.4, 0.8));
+	data->SetInt32(STACK_GRID_COUNT_X, 1);
+	data->SetInt32(STACK_GRID_COUNT_Z, 1);
+	data->SetFloat(STACK_GRID_SPACING_X, 50.0);
+	data->SetFloat(STACK_GRID_SPACING_Z, 120.0);
+	data->SetBool(STACK_GROWTH_ENABLE, false);
+	data->SetFloat(STACK_GROWTH_AMOUNT, 1.0);
+	data->SetInt32(STACK_LOD_MODE, STACK_LOD_MODE_OFF);
+	data->SetInt32(STACK_LOD_THRESHOLD, 10000);
+	data->SetBool(STACK_CULL_HIDDEN, false);
+	data->SetBool(STACK_SKIP_INVISIBLE, false);
+	data->SetBool(STACK_STORE_ITEMS, false);
+	data->SetBool(STACK_COMPACT_ITEMS, false);
 
 	// Return super
 	return SUPER::Init(node);
@@ -78,10 +156,13 @@ Bool StackObject::Message(GeListNode *node, Int32 type, void *data)
 		{
 			BaseContainer* bc = static_cast<BaseObject*>(node)->GetDataInstance();
 			
-			// Limit row count to base count
-			Int32 baseCount = bc->GetInt32(STACK_BASE_COUNT, 0);
-			Int32 maxRows = bc->GetInt32(STACK_ROWS_COUNT, 0);
-			bc->SetInt32(STACK_ROWS_COUNT, Min(maxRows, baseCount));
+			// Limit row count to base count (unless base count is fitted to the item size, then the generator limits the rows)
+			if (!bc->GetBool(STACK_BASE_FITCOUNT))
+			{
+				Int32 baseCount = bc->GetInt32(STACK_BASE_COUNT, 0);
+				Int32 maxRows = bc->GetInt32(STACK_ROWS_COUNT, 0);
+				bc->SetInt32(STACK_ROWS_COUNT, Min(maxRows, baseCount));
+			}
 			
 			break;
 		}
@@ -96,6 +177,53 @@ Bool StackObject::Message(GeListNode *node, Int32 type, void *data)
 			// Get message data
 			DescriptionCommand *dc = (DescriptionCommand*)data;
 			
+			// Print statistics to console
+			if (dc->id == STACK_CMD_PRINTSTATS)
+			{
+				GePrint(GeLoadString(IDS_STACK) + " '" + static_cast<BaseObject*>(node)->GetName() + "': " + _statistics.ToString());
+			}
+			
+			// Run generator benchmark with this object's child and path spline
+			if (dc->id == STACK_CMD_BENCHMARK)
+			{
+				BaseObject *op = static_cast<BaseObject*>(node);
+				BaseObject *child = op->GetDown();
+				SplineObject *pathSpline = static_cast<SplineObject*>(op->GetDataInstance()->GetObjectLink(STACK_BASE_PATH, op->GetDocument()));
+				RunStackBenchmark(child, pathSpline);
+			}
+			
+			// Check generator results against reference data and a serial reference implementation
+			if (dc->id == STACK_CMD_SELFTEST)
+			{
+				RunStackSelfTest();
+			}
+			
+			// Export item matrices and source objects to an instance file
+			if (dc->id == STACK_CMD_EXPORT)
+			{
+				BaseObject *op = static_cast<BaseObject*>(node);
+				Filename filename;
+				if (!_stackGenerator.IsGenerated())
+				{
+					GePrint(GeLoadString(IDS_STACK) + " '" + op->GetName() + "': Nothing to export, the stack has not been generated yet.");
+				}
+				else if (filename.FileSelect(FILESELECTTYPE_ANYTHING, FILESELECT_SAVE, "Export Stack Instances", "cstk"))
+				{
+					Float64 timeStart = GeGetMilliSeconds();
+					if (ExportStackInstances(_stackGenerator, op->GetDown(), op->GetMg(), filename))
+						GePrint(GeLoadString(IDS_STACK) + " '" + op->GetName() + "': Exported " + String::IntToString(_stackGenerator.GetItemCount()) + " items to " + filename.GetString() + " in " + String::FloatToString(GeGetMilliSeconds() - timeStart) + " ms");
+					else
+						GePrint(GeLoadString(IDS_STACK) + " '" + op->GetName() + "': Export to " + filename.GetString() + " failed.");
+				}
+			}
+			
+			// Reset statistics
+			if (dc->id == STACK_CMD_RESETSTATS)
+			{
+				_statistics = StackStatistics();
+				static_cast<BaseObject*>(node)->SetDirty(DIRTYFLAGS_DESCRIPTION);
+			}
+			
 			// Fit STACK_ROWS_HEIGHT to height of child object
 			if (dc->id == STACK_CMD_FITHEIGHT)
 			{
@@ -103,19 +231,29 @@ Bool StackObject::Message(GeListNode *node, Int32 type, void *data)
 				BaseObject *child = static_cast<BaseObject*>(node->GetDown());
 				if (child)
 				{
-					// Get child's bounding box radius
-					Vector rad = child->GetRad();
+					// Get bounding box radius of child and its children, from their cached bounds
+					Vector rad;
+					MinMax boundingBox;
+					if (GetCachedHierarchyBoundingBox(child, boundingBox))
+						rad = boundingBox.GetRad();
 					
-					// If radius invalid
+					// If radius invalid (e.g. child hasn't been evaluated yet)
 					if (rad.IsZero())
 					{
-						// Get a temporary CSTO clone
-						Int32 objectType = 0;
-						AutoFree<BaseObject> pointObject;
-						pointObject.Set(GetCurrentStateToObject(child, objectType));
-						
-						// Calculate radius ourselves
-						rad = CalculateHierarchyBoundingBox(pointObject).GetRad();
+						// Use result of the last calculation, if child and its children haven't changed since
+						UInt32 childDirty = child->GetDirty(DIRTYFLAGS_DATA|DIRTYFLAGS_MATRIX) ^ GetChildrenDirtyChecksum(child, DIRTYFLAGS_DATA|DIRTYFLAGS_MATRIX, false);
+						if (!_fitHeightBounds.Get(child, childDirty, boundingBox))
+						{
+							// Get a temporary CSTO clone
+							Int32 objectType = 0;
+							AutoFree<BaseObject> pointObject;
+							pointObject.Set(GetCurrentStateToObject(child, objectType));
+							
+							// Calculate bounding box ourselves
+							boundingBox = CalculateHierarchyBoundingBox(pointObject);
+							_fitHeightBounds.Set(child, childDirty, boundingBox);
+						}
+						rad = boundingBox.GetRad();
 					}
 
 					// If radius is valid
@@ -154,7 +292,51 @@ Bool StackObject::GetDEnabling(GeListNode *node, const DescID &id, const GeData
 	{
 		// Disable length attribute is a path spline is used
 		case STACK_BASE_LENGTH:
-			return !bc->GetObjectLink(STACK_BASE_PATH, op->GetDocument());
+			return !bc->GetObjectLink(STACK_BASE_PATH, op->GetDocument()) || (bc->GetInt32(STACK_SHAPE) != STACK_SHAPE_WALL);
+			
+		// Only walls can follow a path spline
+		case STACK_BASE_PATH:
+			return bc->GetInt32(STACK_SHAPE) == STACK_SHAPE_WALL;
+			
+		// Statistics are read only
+		case STACK_STATS_ITEMS:
+		case STACK_STATS_CACHEHITS:
+		case STACK_STATS_UPDATES:
+		case STACK_STATS_REBUILDS:
+		case STACK_STATS_TIME_INIT:
+		case STACK_STATS_TIME_GENERATE:
+		case STACK_STATS_TIME_BUILD:
+		case STACK_STATS_FINGERPRINT:
+			return false;
+			
+		// Base count is calculated automatically when it's fitted to the item size
+		case STACK_BASE_COUNT:
+			return !bc->GetBool(STACK_BASE_FITCOUNT);
+			
+		// Colors are only used for random display colors
+		case STACK_RANDOM_COLOR_1:
+		case STACK_RANDOM_COLOR_2:
+			return bc->GetBool(STACK_RANDOM_COLORS);
+			
+		// Growth amount only makes sense when growth is enabled
+		case STACK_GROWTH_AMOUNT:
+			return bc->GetBool(STACK_GROWTH_ENABLE);
+			
+		// Walls are only one item deep, none of their items is hidden
+		case STACK_CULL_HIDDEN:
+			return bc->GetInt32(STACK_SHAPE) != STACK_SHAPE_WALL;
+			
+		// Item threshold only makes sense with a reduced editor display
+		case STACK_LOD_THRESHOLD:
+			return bc->GetInt32(STACK_LOD_MODE) != STACK_LOD_MODE_OFF;
+			
+		// Compact items are not saved with the document
+		case STACK_STORE_ITEMS:
+			return !bc->GetBool(STACK_COMPACT_ITEMS);
+			
+		// Statistic options only make sense when statistics are collected
+		case STACK_STATS_PRINT:
+			return bc->GetBool(STACK_STATS_ENABLE);
 	}
 	
 	// Return super
@@ -162,6 +344,62 @@ Bool StackObject::GetDEnabling(GeListNode *node, const DescID &id, const GeData
 }
 
 
+// Return values of read-only statistics attributes
+Bool StackObject::GetDParameter(GeListNode *node, const DescID &id, GeData &t_data, DESCFLAGS_GET &flags)
+{
+	// Good practice: Check for nullptr
+	if (!node)
+		return false;
+	
+	switch (id[0].id)
+	{
+		case STACK_STATS_ITEMS:
+			t_data = GeData((Int32)_statistics._itemCount);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		case STACK_STATS_CACHEHITS:
+			t_data = GeData(_statistics._cacheHits);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		case STACK_STATS_UPDATES:
+			t_data = GeData(_statistics._cacheUpdates);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		case STACK_STATS_REBUILDS:
+			t_data = GeData(_statistics._cacheRebuilds);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		case STACK_STATS_TIME_INIT:
+			t_data = GeData(_statistics._timeInit);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		case STACK_STATS_TIME_GENERATE:
+			t_data = GeData(_statistics._timeGenerate);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		case STACK_STATS_TIME_BUILD:
+			t_data = GeData(_statistics._timeBuild);
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+			
+		// Fingerprint of the generated stack, useful for external tools that want to skip unchanged stacks
+		case STACK_STATS_FINGERPRINT:
+			t_data = GeData(String::UIntToString(_stackGenerator.GetFingerprint()));
+			flags |= DESCFLAGS_GET_PARAM_GET;
+			return true;
+	}
+	
+	// Return super
+	return SUPER::GetDParameter(node, id, t_data, flags);
+}
+
+
 // Copy internal data to another StackObject
 Bool StackObject::CopyTo(NodeData *dest, GeListNode *snode, GeListNode *dnode, COPYFLAGS flags, AliasTrans *trn)
 {
@@ -174,12 +412,80 @@ Bool StackObject::CopyTo(NodeData *dest, GeListNode *snode, GeListNode *dnode, C
 	
 	// Copy data
 	destStack->_lastPathSpline = _lastPathSpline;
+	destStack->_lastChildrenDirty = _lastChildrenDirty;
+	
+	// The copied children may not have been evaluated yet, so keep their size
+	destStack->_itemRad = _itemRad;
+	destStack->_itemRadDirty = _itemRadDirty;
+	destStack->_itemRadValid = _itemRadValid;
+	
+	// Share generated items, so the copy (e.g. for rendering) doesn't have to generate them again.
+	// Undo copies are made for every parameter change and are rarely used, so they don't get the items. After an undo, the stack is generated again.
+	Bool copyItems = !(flags & (COPYFLAGS_PRIVATE_UNDO | COPYFLAGS_PRIVATE_NO_INTERNALS));
+	if (!destStack->_stackGenerator.CopyFrom(_stackGenerator, copyItems))
+		return false;
 	
 	// Return SUPER
 	return SUPER::CopyTo(dest, snode, dnode, flags, trn);
 }
 
 
+// Read internal data
+Bool StackObject::Read(GeListNode *node, HyperFile *hf, Int32 level)
+{
+	// Good practice: Check for nullptr
+	if (!hf)
+		return false;
+	
+	// Generated items have been stored since level 1
+	if (level >= 1)
+	{
+		Bool hasItems = false;
+		if (!hf->ReadBool(&hasItems))
+			return false;
+		
+		if (hasItems && !_stackGenerator.ReadItems(hf))
+			return false;
+	}
+	
+	// Size of the stacked objects has been stored since level 2. The stored items were generated for it, and the children might not have bounds yet when the items are validated.
+	// The dirty checksum it was measured for is only valid in the session it was measured in, so the children are measured again as soon as they have bounds.
+	if (level >= 2)
+	{
+		if (!hf->ReadVector(&_itemRad) || !hf->ReadBool(&_itemRadValid))
+			return false;
+		_itemRadDirty = 0;
+	}
+	
+	// Return SUPER
+	return SUPER::Read(node, hf, level);
+}
+
+
+// Write internal data
+Bool StackObject::Write(GeListNode *node, HyperFile *hf)
+{
+	// Good practice: Check for nullptr
+	if (!node || !hf)
+		return false;
+	
+	// Store generated items, so they don't have to be generated again when the document is loaded
+	Bool hasItems = static_cast<BaseObject*>(node)->GetDataInstance()->GetBool(STACK_STORE_ITEMS);
+	if (!hf->WriteBool(hasItems))
+		return false;
+	
+	if (hasItems && !_stackGenerator.WriteItems(hf))
+		return false;
+	
+	// Store size of the stacked objects, the stored items depend on it
+	if (!hf->WriteVector(_itemRad) || !hf->WriteBool(_itemRadValid))
+		return false;
+	
+	// Return SUPER
+	return SUPER::Write(node, hf);
+}
+
+
 // Generate stack
 BaseObject* StackObject::GetVirtualObjects(BaseObject *op, HierarchyHelp *hh)
 {
@@ -206,38 +512,128 @@ BaseObject* StackObject::GetVirtualObjects(BaseObject *op, HierarchyHelp *hh)
 	if (pathSpline)
 		op->AddDependence(hh, pathSpline);
 	
+	// Check children for changes, and hide them (one pass over the whole hierarchy)
+	UInt32 childrenDirtyChecksum = GetChildrenDirtyChecksum(op, DIRTYFLAGS_DATA|DIRTYFLAGS_CACHE|DIRTYFLAGS_MATRIX, true);
+	Bool childrenDirty = childrenDirtyChecksum != _lastChildrenDirty;
+	
+	// Hidden stacks don't need any geometry, if the user says nothing references them. Return an empty placeholder instead, and don't generate or build anything until the stack is visible again.
+	// Stacks that are input of another generator (e.g. a Cloner) are usually hidden, but their output is still used.
+	Bool isRendering = (hh->GetBuildFlag() & (BUILDFLAGS_INTERNALRENDERER|BUILDFLAGS_EXTERNALRENDERER)) != BUILDFLAGS_0;
+	if (bc->GetBool(STACK_SKIP_INVISIBLE) && !IsGeneratorInput(op) && !IsObjectVisible(op, doc, isRendering))
+	{
+		BaseObject *cache = op->GetCache(hh);
+		if (_placeholder && cache && !op->CheckCache(hh) && !op->IsDirty(DIRTYFLAGS_DATA))
+			return cache;
+		
+		_placeholder = true;
+		return BaseObject::Alloc(Onull);
+	}
+	
+	// Get stack parameters from container, and the state of the inputs
+	StackParameters params(*bc, *doc);
+	params._sourceDirty = childrenDirtyChecksum;
+	
+	// Every child is a variation that items can choose from
+	params._variationCount = 0;
+	for (BaseObject *variation = child; variation && params._variationCount < CANSTACK_MAX_VARIATIONS; variation = variation->GetNext())
+		params._variationCount++;
+	
+	// Size of the stacked objects. The largest one decides, so no items overlap.
+	Bool fitCount = bc->GetBool(STACK_BASE_FITCOUNT);
+	if (fitCount || params._settleIterations > 0)
+	{
+		Vector itemRad;
+		Bool hasItemRad = GetItemRadius(child, params._variationCount, childrenDirtyChecksum, itemRad);
+		
+		// Derive number of items from the item size along the stack. While the size is not known, the greyed out Base Count must not be used, so start with a single item.
+		if (fitCount)
+		{
+			if (!hasItemRad || itemRad.z <= 0.0)
+				params._baseCount = 1;
+			else if (!_stackGenerator.FitBaseCount(params, itemRad.z * 2.0))
+				return nullptr;
+		}
+		
+		// Items are settled as cylinders standing on the row
+		params._itemRadius = Max(itemRad.x, itemRad.z);
+	}
+	
+	// Reduce level of detail for large stacks in the editor. Renderers always get the full stack.
+	StackBuildSettings buildSettings(params._renderInstances, STACK_LOD_MODE_OFF);
+	if (!isRendering && CanStackGenerator::CalculateItemCount(params) >= bc->GetInt32(STACK_LOD_THRESHOLD))
+		buildSettings._lodMode = bc->GetInt32(STACK_LOD_MODE);
+	
+	// Items inside of 3D stacks can't be seen, neither in the editor nor in renderings
+	buildSettings._cullHidden = bc->GetBool(STACK_CULL_HIDDEN);
+	
+	// Pass random values of the items to their display color
+	buildSettings._itemColors = bc->GetBool(STACK_RANDOM_COLORS);
+	buildSettings._color1 = bc->GetVector(STACK_RANDOM_COLOR_1);
+	buildSettings._color2 = bc->GetVector(STACK_RANDOM_COLOR_2);
+	
+	// In growth mode, the stack is always generated completely, and only the first part of it is shown.
+	// Animating the visible part only shows or hides items, nothing is generated or cloned again.
+	Int visibleCount = NOTOK;
+	if (bc->GetBool(STACK_GROWTH_ENABLE))
+		visibleCount = (Int)Floor(ClampValue(bc->GetFloat(STACK_GROWTH_AMOUNT), 0.0, 1.0) * (Float)CanStackGenerator::CalculateItemCount(params) + 0.5);
+	
 	// Check if we need to recalculate
-	Bool dirty = op->CheckCache(hh) || op->IsDirty(DIRTYFLAGS_DATA) || IsDirtyChildren(op, DIRTYFLAGS_DATA|DIRTYFLAGS_CACHE|DIRTYFLAGS_MATRIX) || (pathSpline != _lastPathSpline) || !op->CompareDependenceList();
+	Bool dirty = _placeholder || op->CheckCache(hh) || op->IsDirty(DIRTYFLAGS_DATA) || childrenDirty || (pathSpline != _lastPathSpline) || !op->CompareDependenceList() || (params.GetFingerprint() != _stackGenerator.GetFingerprint()) || (buildSettings != _stackGenerator.GetBuildSettings()) || (visibleCount != _stackGenerator.GetVisibleCount());
 	
 	// Return cache if nothing important has changed
 	if (!dirty)
 	{
-		// Hide child objects, return previously generated cache
-		TouchAllChildren(op);
+		// Count cache hit
+		if (bc->GetBool(STACK_STATS_ENABLE))
+			_statistics._cacheHits++;
+		
+		// Return previously generated cache
 		return op->GetCache(hh);
 	}
 	
-	// Get stack parameters from container
-	StackParameters params(*bc, *doc);
-	
 	// Initialize stack
+	Float64 timeStart = GeGetMilliSeconds();
 	if (!_stackGenerator.InitStack(params))
 		return nullptr;
+	Float64 timeInit = GeGetMilliSeconds();
 	
 	// Generate stack item
 	if (!_stackGenerator.GenerateStack())
 		return nullptr;
+	Float64 timeGenerate = GeGetMilliSeconds();
+	
+	// If children are unchanged and the number of items is the same, just move the previously generated items. A placeholder has no items to move.
+	BaseObject *cache = _placeholder ? nullptr : op->GetCache(hh);
+	if (cache && !childrenDirty && !(_stackGenerator.GetLastChanges() & STACKCHANGE_STRUCTURE))
+	{
+		if (_stackGenerator.UpdateStackGeometry(cache, op->GetMg(), buildSettings, visibleCount))
+		{
+			// Update internal values for later dirty detection
+			_lastPathSpline = pathSpline;
+			_lastChildrenDirty = childrenDirtyChecksum;
+			
+			RecordStatistics(op, false, timeStart, timeInit, timeGenerate);
+			
+			return cache;
+		}
+	}
+	
+	// If the children haven't changed, the clones in the previous cache are still valid and can be reused instead of cloning the children again
+	maxon::BaseArray<BaseObject*> references;
+	if (cache && !childrenDirty && !_stackGenerator.DetachReferences(cache, references))
+		return nullptr;
 	
 	// Build geometry
-	BaseObject *result = _stackGenerator.BuildStackGeometry(op->GetDown(), op->GetMg(), bc->GetBool(STACK_RENDERINSTANCES));
+	BaseObject *result = _stackGenerator.BuildStackGeometry(op->GetDown(), op->GetMg(), buildSettings, &references, visibleCount);
 	if (!result)
 		return nullptr;
 	
-	// Hide all child objects
-	TouchAllChildren(op);
+	RecordStatistics(op, true, timeStart, timeInit, timeGenerate);
 	
 	// Update internal values for later dirty detection
 	_lastPathSpline = pathSpline;
+	_lastChildrenDirty = childrenDirtyChecksum;
+	_placeholder = false;
 	
 	// Name parent result object
 	result->SetName(GeLoadString(IDS_STACK));
@@ -250,6 +646,80 @@ BaseObject* StackObject::GetVirtualObjects(BaseObject *op, HierarchyHelp *hh)
 }
 
 
+// Measure the stacked objects
+Bool StackObject::GetItemRadius(BaseObject *firstVariation, Int32 variationCount, UInt32 childrenDirty, Vector &itemRad)
+{
+	// Render instances are measured by their linked objects, which are not children of the Stack object, so their state counts, too
+	UInt32 dirty = childrenDirty;
+	BaseObject *variation = firstVariation;
+	for (Int32 variationIndex = 0; variation && variationIndex < variationCount; ++variationIndex, variation = variation->GetNext())
+	{
+		BaseObject *reference = CanStackGenerator::GetReferenceObject(variation);
+		if (reference && reference != variation)
+			dirty = (dirty ^ reference->GetDirty(DIRTYFLAGS_DATA|DIRTYFLAGS_CACHE)) * 16777619U;
+	}
+	
+	// Nothing has changed since the last measurement
+	if (_itemRadValid && dirty == _itemRadDirty)
+	{
+		itemRad = _itemRad;
+		return true;
+	}
+	
+	// Use the bounds the objects have cached
+	Vector measuredRad;
+	Bool hasBounds = false;
+	variation = firstVariation;
+	for (Int32 variationIndex = 0; variation && variationIndex < variationCount; ++variationIndex, variation = variation->GetNext())
+	{
+		MinMax childBounds;
+		if (GetCachedHierarchyBoundingBox(CanStackGenerator::GetReferenceObject(variation), childBounds))
+		{
+			Vector childRad = childBounds.GetRad();
+			measuredRad = Vector(Max(measuredRad.x, childRad.x), Max(measuredRad.y, childRad.y), Max(measuredRad.z, childRad.z));
+			hasBounds = true;
+		}
+	}
+	
+	// Objects without bounds are measured again next time, until they have been evaluated
+	if (hasBounds)
+	{
+		_itemRad = measuredRad;
+		_itemRadDirty = dirty;
+		_itemRadValid = true;
+	}
+	
+	itemRad = _itemRad;
+	return _itemRadValid;
+}
+
+
+// Store statistics of a stack generation
+void StackObject::RecordStatistics(BaseObject *op, Bool rebuilt, Float64 timeStart, Float64 timeInit, Float64 timeGenerate)
+{
+	// Statistics are opt-in
+	BaseContainer *bc = op->GetDataInstance();
+	if (!bc->GetBool(STACK_STATS_ENABLE))
+		return;
+	
+	// Store timings
+	_statistics._timeInit = timeInit - timeStart;
+	_statistics._timeGenerate = timeGenerate - timeInit;
+	_statistics._timeBuild = GeGetMilliSeconds() - timeGenerate;
+	_statistics._itemCount = _stackGenerator.GetItemCount();
+	
+	// Count update or rebuild
+	if (rebuilt)
+		_statistics._cacheRebuilds++;
+	else
+		_statistics._cacheUpdates++;
+	
+	// Print to console, so heavy stacks can be identified in large scenes
+	if (bc->GetBool(STACK_STATS_PRINT))
+		GePrint(GeLoadString(IDS_STACK) + " '" + op->GetName() + "' " + (rebuilt ? "rebuilt: " : "updated: ") + _statistics.ToString());
+}
+
+
 //----------------------------------------------------------------------------------------
 ///	Plugin help support callback. Can be used to display context sensitive help when the
 /// user selects "Show Help" for an object or attribute. <B>Only return true for your own
@@ -278,7 +748,7 @@ static Bool CanStackHelpDelegate(const String &opType, const String &baseType, c
 // Register object plugin and help delegate
 Bool RegisterStackObject()
 {
-	if (!RegisterObjectPlugin(ID_STACK, GeLoadString(IDS_STACK), OBJECT_GENERATOR|OBJECT_INPUT, StackObject::Alloc, "Ostack", AutoBitmap("ostack.tif"), 0))
+	if (!RegisterObjectPlugin(ID_STACK, GeLoadString(IDS_STACK), OBJECT_GENERATOR|OBJECT_INPUT, StackObject::Alloc, "Ostack", AutoBitmap("ostack.tif"), 2))
 		return false;
 	
 	return RegisterPluginHelpDelegate(ID_STACK, CanStackHelpDelegate);